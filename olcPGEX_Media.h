@@ -6,6 +6,8 @@
 // - Only one media file can be played per single Media instance
 
 // Define OLC_MEDIA_CUSTOM_AUDIO_PLAYBACK to not use default miniaud.io playback and play the audio yourself
+// Define OLC_MEDIA_NO_SIMD to convert all video frames with swscale instead of built-in SIMD converters
+// Define OLC_MEDIA_NO_IO_URING to leave out the io_uring file backend on Linux
 
 // TODO:
 // - Check if video/audio is opened before every function related to video/audio (?)
@@ -32,7 +34,7 @@ extern "C" {
 
 // Audio dependencies
 #include <libavutil/avutil.h>
-#include <libavutil/audio_fifo.h>
+#include <libavutil/samplefmt.h>
 #include <libswresample/swresample.h>
 }
 
@@ -56,8 +58,18 @@ extern "C" {
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <future>
 #include <queue>
 #include <algorithm>
+#include <functional>
 
 
 #ifdef _WIN32
@@ -66,21 +78,168 @@ extern "C" {
 #else 
 // Use C IO for other platforms
 #include <cstdio>
+// Used to raise audio decoding thread priority
+#include <pthread.h>
+// Used by memory mapped file IO
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif // _WIN32
 
+// io_uring is used through system calls directly, so that liburing isn't needed
+#if defined(__linux__) && !defined(OLC_MEDIA_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef __NR_io_uring_setup
+#define OLC_MEDIA_IO_URING
+#endif
+#endif
+#endif
+
+#ifndef OLC_MEDIA_NO_SIMD
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define OLC_MEDIA_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+// Used to detect supported instruction sets
+#include <intrin.h>
+#endif // _MSC_VER
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define OLC_MEDIA_NEON
+#include <arm_neon.h>
+#endif
+#endif // OLC_MEDIA_NO_SIMD
+
+// GCC and Clang only allow intrinsics of instruction sets that are enabled for the function, while MSVC always allows them
+#if defined(OLC_MEDIA_X86) && (defined(__GNUC__) || defined(__clang__))
+#define OLC_MEDIA_TARGET(instruction_set) __attribute__((target(instruction_set)))
+#else
+#define OLC_MEDIA_TARGET(instruction_set)
+#endif
+
 
 // This definition usually gets set automatically by the IDEs
 #ifdef NDEBUG
 // Release macro
-#define OLC_MEDIA_ASSERT(condition, message) if(!(condition)){return Result::Error;}
+#define OLC_MEDIA_ASSERT_RETURN(condition, message, return_value) if(!(condition)){return (return_value);}
 #else
 // Debug macro
-#define OLC_MEDIA_ASSERT(condition, message) if(!(condition)){std::cerr << "[OLC_MEDIA]: " << (message) << '\n'; return Result::Error;}
+#define OLC_MEDIA_ASSERT_RETURN(condition, message, return_value) if(!(condition)){std::cerr << "[OLC_MEDIA]: " << (message) << '\n'; return (return_value);}
 #endif
 
+#define OLC_MEDIA_ASSERT(condition, message) OLC_MEDIA_ASSERT_RETURN(condition, message, Result::Error)
+
 // Declarations
 namespace olc {
+    // Shared pool of worker threads, that can run decoding of many "Media" instances instead of each
+    // instance creating its own threads. Useful when a lot of media is played at once.
+    // Tasks are run in earliest deadline first order, where deadline is the time point at which a task's
+    // media would run out of decoded data. Each worker has its own task queue, and workers take the most
+    // urgent task from queues of other workers when it's more urgent than their own (work stealing).
+    //
+    // NOTE: Executor must outlive all the "Media" instances that use it.
+    class MediaExecutor {
+    public:
+        enum class TaskResult {
+            Continue, // Task has more work to do
+            Park,     // Task can't continue until "Wake()" is called
+            Done,     // Task won't be run again (until it's submitted again)
+        };
+
+        // Work item that is repeatedly run by the executor
+        class Task {
+        public:
+            virtual ~Task() = default;
+
+            // Should do a small, bounded amount of work
+            virtual TaskResult Step() = 0;
+
+            // Time point until which the task's results are needed
+            virtual std::chrono::steady_clock::time_point Deadline() = 0;
+
+        private:
+            friend class MediaExecutor;
+
+            enum class State {
+                Parked,
+                Queued,
+                Running,
+                RunningWoken, // Woken up while running, so it must be queued again, even if it asks to park
+                Done,
+            };
+
+            std::atomic<State> state = State::Done;
+            std::atomic<bool> wake_requested = false; // Set by "WakeFromRealtimeThread()"
+        };
+
+        // thread_count: amount of worker threads. 0 picks it from "std::thread::hardware_concurrency()".
+        MediaExecutor(unsigned int thread_count = 0);
+        ~MediaExecutor();
+
+        MediaExecutor(const MediaExecutor&) = delete;
+        MediaExecutor& operator=(const MediaExecutor&) = delete;
+
+        // Queues the task to be run. Task must stay alive until "WaitUntilDone()" returns for it.
+        void Submit(Task* task);
+
+        // Queues parked task again. Does nothing if task is already queued, running or done.
+        void Wake(Task* task);
+
+        // Same as "Wake()", but never blocks. Wake up may be delayed by up to "realtime_wake_latency".
+        void WakeFromRealtimeThread(Task* task);
+
+        // Blocks until task returns "Done"
+        void WaitUntilDone(Task* task);
+
+        unsigned int GetThreadCount();
+
+    private:
+        struct QueuedTask {
+            std::chrono::steady_clock::time_point deadline;
+            Task* task;
+        };
+
+        struct Worker {
+            std::mutex mutex;
+            std::vector<QueuedTask> queue; // Min-heap by deadline
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<size_t> next_worker = 0;    // Used to spread tasks, that are queued from outside of worker threads
+        std::atomic<size_t> queued_tasks = 0;
+        std::atomic<bool> realtime_wakes = false; // True if some task has "wake_requested" set
+        std::atomic<bool> stopping = false;
+
+        std::mutex mutex; // Guards "tasks" and sleeping of idle workers
+        std::condition_variable work_available;
+        std::condition_variable task_done;
+        std::vector<Task*> tasks; // Submitted tasks that aren't done yet
+
+        // Task is queued again after running for this long, so that more urgent tasks get a chance to run
+        static constexpr std::chrono::milliseconds time_slice{ 2 };
+        static constexpr std::chrono::milliseconds realtime_wake_latency{ 10 };
+
+        void WorkerThread(size_t worker_index);
+        void Enqueue(Task* task);
+        // Pops the most urgent task out of all worker queues, preferring own queue on ties
+        Task* Dequeue(size_t worker_index);
+        void Run(Task* task);
+        void ProcessRealtimeWakes();
+        // Index of the worker that calls this function, or "workers.size()" if called from other thread
+        size_t CurrentWorkerIndex();
+        // Executor and worker index of the calling thread
+        static std::pair<const MediaExecutor*, size_t>& ThisThreadWorker();
+        static bool LaterDeadline(const QueuedTask& a, const QueuedTask& b);
+    };
+
 	class Media {
+        // Lets tests and benchmarks reach the internals (see "tests" directory)
+        friend struct MediaTestAccess;
+
     public:
         enum class Result {
             ResSuccess = 0,
@@ -98,30 +257,236 @@ namespace olc {
             F32        // Float
         };
 
+        // Threading modes that can be used by the video decoder.
+        enum class DecoderThreadType {
+            Auto,      // Frame threading if the codec supports it, otherwise slice threading.
+            Frame,     // Decodes several frames in parallel. Fastest, but adds "thread count" frames of decoding delay.
+            Slice,     // Decodes slices of a single frame in parallel. Doesn't add delay, but only helps if the video was encoded with multiple slices.
+        };
+
+        // Ways media files can be read.
+        enum class FileIOType {
+            Auto,         // Memory mapped when supported, otherwise buffered
+            Buffered,     // Reads file in chunks with pread (ReadFile on Windows)
+            MemoryMapped, // Maps the whole file into memory and copies from it. Not supported on Windows.
+            IoUring,      // Keeps several reads in flight with io_uring (Linux only). Falls back to Buffered when io_uring isn't available.
+        };
+
+        // Steps of video decoding quality. When video decoding can't keep up with playback, quality is lowered
+        // one step at a time, and raised back once decoding keeps up again.
+        enum class VideoDecodeQuality {
+            Full,
+            SkipLoopFilter,      // Skips deblocking filter, which leaves small artifacts
+            DiscardNonReference, // Skips frames that other frames don't depend on
+            LowResolution,       // Decodes frames at half resolution. Skipped if codec doesn't support it.
+            KeyframesOnly,       // Only decodes keyframes
+        };
+
+        // Algorithms that can be used to scale video frames to the output size.
+        enum class VideoScaler {
+            Point,         // Nearest neighbour. Fastest, but blocky.
+            FastBilinear,  // Faster, less accurate bilinear.
+            Bilinear,
+            Bicubic,       // Sharpest, but slowest.
+        };
+
+        // Custom source of media data, that can be passed to "Open()". Allows streaming media from archives, encrypted or
+        // compressed files, network, etc. without loading the whole media into memory first.
+        // Functions of a single source are never called by several threads at the same time, but they might be
+        // called by a different thread than the one that opened the media.
+        class IOSource {
+        public:
+            virtual ~IOSource() = default;
+
+            // Reads up to "size" bytes at the current position.
+            // Returns amount of bytes read, 0 at the end of data and negative value on error.
+            virtual int64_t Read(uint8_t* buffer, int64_t size) = 0;
+
+            // Moves the current position. Whence: SEEK_SET, SEEK_CUR and SEEK_END
+            // Returns the new position, or negative value on error.
+            virtual int64_t Seek(int64_t offset, int whence) = 0;
+
+            // Returns size of the data in bytes, or negative value if it's unknown.
+            virtual int64_t Size() { return -1; }
+
+            // Hint, that bytes from "offset" to "offset + size" will be read soon. Slow sources can start loading or
+            // decoding them in the background. Only called when "Settings::io_readahead_size" isn't 0.
+            virtual void Prefetch(int64_t /*offset*/, int64_t /*size*/) {}
+
+            // Returns a new source of the same data, with its own position. Used to build the index in the background
+            // (see "Settings::build_index"). If nullptr is returned, index isn't built.
+            virtual std::unique_ptr<IOSource> Clone() { return nullptr; }
+        };
+
         // All settings must have default value
         struct Settings {
+            // Index of the stream in the media file, that is decoded when video/audio is opened.
+            // -1 picks the best stream automatically. Streams that aren't decoded are skipped by the demuxer.
+            int video_stream = -1;
+            int audio_stream = -1;
+
+            // How the media file is read (see "FileIOType").
+            FileIOType file_io = FileIOType::Auto;
+
+            // Size of the buffer FFMPEG reads the file into. Bigger buffer means less read calls.
+            uint32_t io_buffer_size = 64 * 1024;
+
+            // Bytes that a background thread reads ahead of the demuxer, so that slow disks (network drives, etc.)
+            // don't stall decoding. Only used when file isn't memory mapped. 0 disables the readahead thread.
+            size_t io_readahead_size = 8 * 1024 * 1024;
+
+            // Amount of 256KB reads that "FileIOType::IoUring" keeps in flight ahead of the demuxer.
+            uint8_t io_uring_reads = 8;
+
+            // If true, media is read as a live stream: from a pipe, a file that is still being written, etc.
+            // Media isn't rewound after probing and can't be seeked or indexed. Running out of data only ends the media
+            // once no new data arrived for "live_read_timeout" seconds. File is always read with "FileIOType::Buffered",
+            // and without the readahead thread.
+            bool live_input = false;
+            double live_read_timeout = 5.0;
+
+            // Limits on how many bytes, and how many seconds of media, are analyzed to find the streams of live input.
+            // Smaller values open the stream sooner, but might miss streams that start later.
+            int64_t live_probe_size = 32 * 1024;
+            double live_analyze_duration = 0.5;
+
             // Audio and video buffer scaler. Only suggested to increase it, if you notice some video/audio 
             // frames are skipped, which could happen if video/audio frames aren't interleaved as often.
             uint8_t preloaded_frames_scale = 1;
 
             // Output format of the audio.
             AudioFormat audio_format = AudioFormat::Default;
+
+            // Amount of threads the video decoder is allowed to use.
+            // 0 picks the amount automatically from "std::thread::hardware_concurrency()", 1 disables decoder threading.
+            uint8_t video_decoder_thread_count = 0;
+
+            // Threading mode of the video decoder. Ignored when only a single decoder thread is used.
+            DecoderThreadType video_decoder_thread_type = DecoderThreadType::Auto;
+
+            // Amount of threads that convert a single video frame to RGBA, each converting its own band of rows.
+            // 0 picks the amount automatically from "std::thread::hardware_concurrency()", 1 converts on the converter thread only.
+            // NOTE: Frames that have to be scaled with swscale are always converted by a single thread.
+            uint8_t video_converter_thread_count = 1;
+
+            // Video frames are scaled to fit inside this box, keeping aspect ratio. Scaling is done during pixel format
+            // conversion, so smaller output also makes conversion, copying and texture upload faster.
+            // 0 means no limit for that dimension. Video is never scaled above its original size.
+            int video_output_width = 0;
+            int video_output_height = 0;
+
+            // Algorithm used to scale video frames to the output size. Swscale also uses it to upsample chroma.
+            VideoScaler video_scaler = VideoScaler::Bilinear;
+
+            // Amount of sprite/decal pairs that "GetVideoFrame" functions rotate through. Every new frame is uploaded into
+            // the next pair, so previously returned decals keep their pixels for "video_output_frames - 1" more new frames
+            // (useful for transitions between frames). Every pair takes a full frame of CPU and GPU memory.
+            uint8_t video_output_frames = 2;
+
+            // If true, video decoding quality is lowered while decoding falls behind playback (see "VideoDecodeQuality").
+            // Only applies when "GetVideoFrame(delta_time)" is used.
+            bool adaptive_video_quality = true;
+
+            // Milliseconds of video that are decoded ahead of time (multiplied by "preloaded_frames_scale").
+            uint32_t video_preroll_ms = 2000;
+
+            // Maximum amount of bytes decoded and converted video frames are allowed to take. Limits the amount of
+            // frames decoded ahead of time for high resolution videos. 0 means no limit.
+            // NOTE: At least 2 decoded frames are always kept, even if they don't fit into the budget.
+            size_t video_memory_budget = 256 * 1024 * 1024;
+
+            // If set, decoding runs on the shared executor instead of threads created by this Media instance.
+            // Executor must outlive the Media instance.
+            MediaExecutor* executor = nullptr;
+
+            // If true, index of the video packets is taken from the container (MP4, AVI), or built in the background
+            // by reading the whole file once, when the container doesn't list every packet.
+            // Index allows seeking straight to the right keyframe, "GetFrameCount()", "SeekToFrame()" and "EstimateSeekCost()".
+            bool build_index = false;
+
+            // If not empty, index is loaded from this file (if it exists and belongs to the same media) instead of being built.
+            // Otherwise, built index is saved into this file.
+            std::string index_cache_path;
         };
 
     private:
-        // Thread safe "queue" that uses circular buffer
-        class VideoQueue {
-        private:
-            uint16_t _size = 0;
-            uint16_t _capacity = 0;
+        // Wait-free single producer/single consumer circular buffer.
+        // Producer fills "back()" and commits it with "push()", consumer reads "front()" and releases it with "pop()".
+        // Neither side locks, so waking up the other side is left to the caller: "push()" and "pop()" return true
+        // only when the size crosses high/low watermark, which is when the other side might be waiting.
+        template<typename T>
+        class SPSCRing {
+        protected:
+            std::vector<T> _slots;
 
-            uint16_t _insert_idx = 0; // idx that points to location where new element will be inserted
-            uint16_t _delete_idx = 0; // idx that points to location where oldest element will be deleted from
+            std::atomic<size_t> _head = 0; // Total amount of popped elements (only written by consumer)
+            std::atomic<size_t> _tail = 0; // Total amount of pushed elements (only written by producer)
 
-            AVFrame** _data = nullptr;
+            size_t _low_watermark = 0;  // Producer is woken up when size drops to this value
+            size_t _high_watermark = 1; // Consumer is woken up when size grows to this value
 
-            mutable std::mutex _mut;
+            void init_ring(size_t capacity, size_t low_watermark, size_t high_watermark) {
+                _slots.resize(capacity);
+                _head = 0;
+                _tail = 0;
+                _low_watermark = std::min(low_watermark, capacity - 1);
+                _high_watermark = std::max(std::min(high_watermark, capacity), size_t(1));
+            }
+
+        public:
+            // Only valid for producer while "full()" is false
+            T& back() {
+                return _slots[_tail.load(std::memory_order_relaxed) % _slots.size()];
+            }
+
+            // Only valid for consumer while "size()" is above 0
+            T& front() {
+                return _slots[_head.load(std::memory_order_relaxed) % _slots.size()];
+            }
+
+            // Push updated element from "back()".
+            // Returns true if consumer should be woken up
+            bool push() {
+                size_t tail = _tail.load(std::memory_order_relaxed) + 1;
+                _tail.store(tail, std::memory_order_release);
+
+                // Consumer index can't move while consumer is waiting, so exact crossing can't be missed
+                return tail - _head.load(std::memory_order_acquire) == _high_watermark;
+            }
+
+            // Returns true if producer should be woken up
+            bool pop_index() {
+                size_t head = _head.load(std::memory_order_relaxed) + 1;
+                _head.store(head, std::memory_order_release);
+
+                return _tail.load(std::memory_order_acquire) - head == _low_watermark;
+            }
+
+            size_t size() const {
+                // Load head first, so that tail is never behind it
+                size_t head = _head.load(std::memory_order_acquire);
+                size_t tail = _tail.load(std::memory_order_acquire);
+                return tail - head;
+            }
+
+            size_t capacity() const {
+                return _slots.size();
+            }
+
+            bool full() const {
+                return size() >= _slots.size();
+            }
+        };
+
+        // Decoded video frame, tagged with the seek serial it was decoded for
+        struct DecodedFrame {
+            AVFrame* frame = nullptr;
+            int serial = 0;
+        };
 
+        // Ring of decoded video frames.
+        // Producer is the video decoder thread, consumer is the video converter thread.
+        class VideoQueue : public SPSCRing<DecodedFrame> {
         public:
             VideoQueue() {
             }
@@ -132,14 +497,10 @@ namespace olc {
             }
 
             // Suggested to set capacity to fps (but min capacity must be 2)
-            Result init(uint16_t capacity) {
-                // Always reset the values
-                _size = 0;
-                _insert_idx = 0;
-                _delete_idx = 0;
-
+            // Should only be called while neither producer nor consumer is running.
+            Result init(uint16_t capacity, size_t low_watermark, size_t high_watermark) {
                 // If video fifo was already in use, reset it first
-                if (_data != nullptr) {
+                if (_slots.empty() == false) {
                     clear();
                     free();
                 }
@@ -147,175 +508,588 @@ namespace olc {
                 if (capacity <= 1)
                     return Result::Error;
 
-                _data = new AVFrame * [capacity];
-                if (_data == nullptr)
-                    return Result::Error;
-
-                _capacity = capacity;
-                for (uint16_t i = 0; i < _capacity; ++i) {
-                    _data[i] = av_frame_alloc();
+                init_ring(capacity, low_watermark, high_watermark);
+                for (DecodedFrame& slot : _slots) {
+                    slot.frame = av_frame_alloc();
+                    slot.serial = 0;
 
                     // Memory might run out if capacity is too big (which might happen if video fps is insanely large)
-                    if (_data[i] == nullptr)
+                    if (slot.frame == nullptr)
                         return Result::Error;
                 }
 
                 return Result::ResSuccess;
             }
 
-            AVFrame* back() const {
-                std::unique_lock<std::mutex> lock(_mut);
-                return _data[_insert_idx];
+            // Pop AVFrame from the front() unreferencing it
+            // Returns true if producer should be woken up
+            bool pop() {
+                av_frame_unref(front().frame);
+                return pop_index();
             }
 
-            AVFrame* front() const {
-                std::unique_lock<std::mutex> lock(_mut);
-                return _data[_delete_idx];
+            // Should only be called while neither producer nor consumer is running
+            void clear() {
+                for (DecodedFrame& slot : _slots) {
+                    av_frame_unref(slot.frame);
+                }
+
+                _head = 0;
+                _tail = 0;
             }
 
-            // Push updated AVFrame from "back()"
-            void push() {
-                std::unique_lock<std::mutex> lock(_mut);
+            // De-allocates fifo structure
+            void free() {
+                for (DecodedFrame& slot : _slots) {
+                    av_frame_free(&slot.frame);
+                }
 
-                _insert_idx = (_insert_idx + 1) % _capacity;
-                ++_size;
+                _slots.clear();
+                _head = 0;
+                _tail = 0;
             }
+        };
 
-            // Pop AVFrame from the front() unreferencing it
-            // If size is 0, does nothing
-            void pop() {
-                std::unique_lock<std::mutex> lock(_mut);
+        // Wait-free single producer/single consumer ring of interleaved audio samples.
+        // Producer is the audio decoder thread and consumer is the audio playback callback, which must never block,
+        // so neither side takes a lock. "pop()" reports when the size crosses low watermark, so that the caller can
+        // wake up the producer only then.
+        // After seeking, producer calls "restart()", which makes consumer skip the samples of the old position.
+        class AudioQueue {
+        private:
+            std::vector<uint8_t> _buffer;
+            size_t _capacity = 0;     // In samples (single sample contains values of all channels)
+            size_t _sample_bytes = 0; // Size of single sample in bytes
+
+            std::atomic<size_t> _head = 0; // Total amount of popped samples (only written by consumer)
+            std::atomic<size_t> _tail = 0; // Total amount of pushed samples (only written by producer)
+
+            size_t _low_watermark = 0;
+
+            // Samples pushed before "_start" belong to the position before the latest "restart()".
+            // "_start_time" is the timestamp of the sample at "_start".
+            std::atomic<size_t> _start = 0;
+            std::atomic<double> _start_time = 0.0;
+            std::atomic<int> _serial = 0;
+
+            // Copies "samples" samples between ring position "pos" and linear "data", handling wrap around
+            void copy_out(size_t pos, uint8_t* data, size_t samples) const {
+                size_t offset = pos % _capacity;
+                size_t first = std::min(samples, _capacity - offset);
+                memcpy(data, _buffer.data() + offset * _sample_bytes, first * _sample_bytes);
+                memcpy(data + first * _sample_bytes, _buffer.data(), (samples - first) * _sample_bytes);
+            }
 
-                if (_size > 0) {
-                    av_frame_unref(_data[_delete_idx]);
+            void copy_in(size_t pos, const uint8_t* data, size_t samples) {
+                size_t offset = pos % _capacity;
+                size_t first = std::min(samples, _capacity - offset);
+                memcpy(_buffer.data() + offset * _sample_bytes, data, first * _sample_bytes);
+                memcpy(_buffer.data(), data + first * _sample_bytes, (samples - first) * _sample_bytes);
+            }
 
-                    _delete_idx = (_delete_idx + 1) % _capacity;
-                    --_size;
-                }
+        public:
+            AudioQueue() {
             }
 
-            size_t size() const {
-                std::unique_lock<std::mutex> lock(_mut);
-                return _size;
+            ~AudioQueue() {
+                free();
             }
 
-            size_t capacity() const {
-                std::unique_lock<std::mutex> lock(_mut);
-                return _capacity;
+            // Suggested to set capacity to sample rate.
+            // Format must be interleaved (non planar).
+            // Should only be called while neither producer nor consumer is running.
+            Result init(AVSampleFormat format, int channels, int capacity, int low_watermark) {
+                // If these parameters are 0, there is something wrong
+                if (capacity <= 0 || channels <= 0)
+                    return Result::Error;
+
+                int bytes_per_sample = av_get_bytes_per_sample(format);
+                if (bytes_per_sample <= 0)
+                    return Result::Error;
+
+                _capacity = capacity;
+                _sample_bytes = size_t(bytes_per_sample) * channels;
+                _low_watermark = std::min(size_t(std::max(low_watermark, 0)), _capacity - 1);
+                _buffer.assign(_capacity * _sample_bytes, 0);
+                clear();
+
+                return Result::ResSuccess;
+            }
+
+            // Pushes as many samples from "data[0]" as there is space for.
+            // Returns amount of samples that were pushed
+            int push(void** data, int samples) {
+                size_t tail = _tail.load(std::memory_order_relaxed);
+                size_t space = _capacity - (tail - _head.load(std::memory_order_acquire));
+                size_t count = std::min(size_t(std::max(samples, 0)), space);
+
+                copy_in(tail, (const uint8_t*)data[0], count);
+                _tail.store(tail + count, std::memory_order_release);
+
+                return int(count);
+            }
+
+            // Pops up to "samples" samples into "data[0]".
+            // Returns amount of samples that were popped. "wake_producer" is set to true if size crossed low watermark.
+            int pop(void** data, int samples, bool& wake_producer) {
+                size_t head = _head.load(std::memory_order_relaxed);
+                // Load start first, so that tail is never behind it
+                size_t start = _start.load(std::memory_order_acquire);
+                size_t tail = _tail.load(std::memory_order_acquire);
+
+                // Samples of the old position are skipped
+                size_t first = std::max(head, start);
+                size_t count = std::min(size_t(std::max(samples, 0)), tail - first);
+
+                copy_out(first, (uint8_t*)data[0], count);
+                _head.store(first + count, std::memory_order_release);
+
+                size_t queued_before = tail - head;
+                size_t queued_after = tail - (first + count);
+                wake_producer = queued_before > _low_watermark && queued_after <= _low_watermark;
+
+                return int(count);
+            }
+
+            // Makes all the samples that were pushed so far be skipped by consumer, and sets timestamp of the next
+            // pushed sample to "start_time". Should only be called by producer.
+            void restart(double start_time, int serial) {
+                _start_time.store(start_time);
+                _start.store(_tail.load(std::memory_order_relaxed));
+                _serial.store(serial);
+            }
+
+            // Timestamp of the next sample that consumer will pop
+            double played_time(int sample_rate) const {
+                size_t start;
+                double start_time;
+                do {
+                    start = _start.load();
+                    start_time = _start_time.load();
+                } while (start != _start.load());
+
+                size_t head = _head.load(std::memory_order_acquire);
+                size_t played = head > start ? head - start : 0;
+
+                return start_time + double(played) / double(sample_rate);
+            }
+
+            // Serial passed to the latest "restart()"
+            int serial() const {
+                return _serial.load();
+            }
+
+            int size() const {
+                size_t head = _head.load(std::memory_order_acquire);
+                size_t tail = _tail.load(std::memory_order_acquire);
+                return int(tail - head);
+            }
+
+            int capacity() const {
+                return int(_capacity);
             }
 
+            // Size of single sample of all channels in bytes
+            size_t sample_bytes() const {
+                return _sample_bytes;
+            }
+
+            // Bytes allocated for samples
+            size_t bytes() const {
+                return _buffer.size();
+            }
+
+            // Empties out all the samples.
+            // Should only be called while neither producer nor consumer is running.
             void clear() {
-                if (_data != nullptr) {
-                    for (uint16_t i = 0; i < _capacity; ++i) {
-                        av_frame_unref(_data[i]);
-                    }
-                    _size = 0;
-                    _insert_idx = 0;
-                    _delete_idx = 0;
-                }
+                _head = 0;
+                _tail = 0;
+                _start = 0;
+                _start_time = 0.0;
+                _serial = 0;
             }
 
             // De-allocates fifo structure
             void free() {
-                if (_data != nullptr) {
-                    for (uint16_t i = 0; i < _capacity; ++i) {
-                        av_frame_free(&_data[i]);
-                    }
+                _buffer.clear();
+                _buffer.shrink_to_fit();
+                _capacity = 0;
+                clear();
+            }
+        };
 
-                    delete[] _data;
-                    _data = nullptr;
+        // Video frame that was already converted to RGBA and is ready to be displayed
+        struct ConvertedFrame {
+            std::vector<olc::Pixel> pixels;
+            double pts = 0.0;
+            int serial = 0; // Seek serial the frame was decoded for
+        };
 
-                    _size = 0;
-                    _insert_idx = 0;
-                    _delete_idx = 0;
+        // Ring of converted video frames.
+        // Producer is the video converter thread, consumer is the thread that calls "GetVideoFrame()".
+        class ConvertedFrameQueue : public SPSCRing<ConvertedFrame> {
+        public:
+            // Allocates "capacity" frames of "pixel_count" pixels each.
+            // Should only be called while neither producer nor consumer is running.
+            void init(size_t capacity, size_t pixel_count) {
+                // Converter is woken up as soon as a single frame is freed
+                init_ring(capacity, capacity - 1, 1);
+
+                for (ConvertedFrame& frame : _slots) {
+                    frame.pixels.resize(pixel_count);
+                    frame.pts = 0.0;
+                    frame.serial = 0;
                 }
             }
+
+            // Returns true if producer should be woken up
+            bool pop() {
+                return pop_index();
+            }
+
+            // Bytes allocated for pixels of all the frames
+            size_t bytes() const {
+                return _slots.empty() ? 0 : _slots.size() * _slots[0].pixels.size() * sizeof(olc::Pixel);
+            }
+
+            // Should only be called while neither producer nor consumer is running
+            void clear() {
+                _head = 0;
+                _tail = 0;
+            }
+
+            // De-allocates the frames
+            void free() {
+                _slots.clear();
+                _slots.shrink_to_fit();
+                _head = 0;
+                _tail = 0;
+            }
         };
 
-        // Thread safe wrapper for audio fifo read/write
-        class AudioQueue {
+#ifdef OLC_MEDIA_X86
+        // Instruction sets supported by the CPU
+        struct CpuFeatures {
+            bool sse41 = false; // Also means that SSSE3 is supported
+            bool avx2 = false;
+
+            // Features are detected once, the first time they are needed
+            static const CpuFeatures& Get();
+            static CpuFeatures Detect();
+        };
+#endif // OLC_MEDIA_X86
+
+        // Converts 8 bit 4:2:0 YUV frames (yuv420p, yuvj420p and nv12) straight into RGBA pixels, using the widest
+        // instruction set the CPU supports. Other formats and frames that have to be scaled are left to swscale.
+        class YuvConverter {
+            friend struct MediaTestAccess;
+
+        public:
+            // Returns false if frame can't be converted without swscale
+            static bool CanConvert(const AVFrame* frame, int target_width, int target_height);
+            // Converts rows from "row_begin" to "row_end" of the frame. Frame must be convertible (see "CanConvert()").
+            // Different rows can be converted by different threads at the same time.
+            static void ConvertRows(const AVFrame* frame, olc::Pixel* target, int row_begin, int row_end);
+            // Name of the instruction set that is used for conversion
+            static const char* GetInstructionSet();
+
+        private:
+            // Fixed point coefficients with 6 fractional bits. They are small enough for all the
+            // products to fit into 16 bits, so that SIMD kernels can process 8 or 16 pixels at once.
+            struct Coefficients {
+                int16_t y_offset;
+                int16_t y;
+                int16_t r_v;
+                int16_t g_u;
+                int16_t g_v;
+                int16_t b_u;
+            };
+
+            // Converts a single row of pixels. For interleaved chroma (nv12), "u" points to UV pairs and "v" is unused.
+            typedef void (*RowFunction)(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int width, const Coefficients& c);
+
+            struct Kernels {
+                const char* instruction_set;
+                RowFunction planar;
+                RowFunction interleaved;
+            };
+
+            // Kernels are picked once, the first time they are needed
+            static const Kernels& GetKernels();
+            static Kernels SelectKernels();
+            static Coefficients GetCoefficients(const AVFrame* frame);
+
+            // Converts pixels from "begin" to "end". Used for the whole row when SIMD isn't available,
+            // and for the pixels that are left over after SIMD kernels.
+            template<bool interleaved>
+            static void ConvertPixels(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int begin, int end, const Coefficients& c);
+            template<bool interleaved>
+            static void ConvertRowScalar(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int width, const Coefficients& c);
+
+#ifdef OLC_MEDIA_X86
+            template<bool interleaved>
+            OLC_MEDIA_TARGET("sse4.1") static void ConvertRowSSE41(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int width, const Coefficients& c);
+            template<bool interleaved>
+            OLC_MEDIA_TARGET("avx2") static void ConvertRowAVX2(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int width, const Coefficients& c);
+#endif // OLC_MEDIA_X86
+
+#ifdef OLC_MEDIA_NEON
+            template<bool interleaved>
+            static void ConvertRowNEON(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int width, const Coefficients& c);
+#endif // OLC_MEDIA_NEON
+        };
+
+        // Copies frames, that decoder already outputs as packed 8 bit RGB (rgba, bgra, rgb0, rgb24, etc.), into RGBA pixels.
+        // Channels are reordered with byte shuffles, without swscale. Frames that have to be scaled are left to swscale.
+        class RgbConverter {
+            friend struct MediaTestAccess;
+
+        public:
+            // Returns true if frames of this format can be converted
+            static bool IsSupportedFormat(AVPixelFormat format);
+            // Returns false if frame can't be converted without swscale
+            static bool CanConvert(const AVFrame* frame, int target_width, int target_height);
+            // Converts rows from "row_begin" to "row_end" of the frame. Frame must be convertible (see "CanConvert()").
+            // Different rows can be converted by different threads at the same time.
+            static void ConvertRows(const AVFrame* frame, olc::Pixel* target, int row_begin, int row_end);
+
+        private:
+            // Byte offsets of channels within a source pixel
+            struct Layout {
+                int bytes_per_pixel = 0; // 0 if format isn't supported
+                int r = 0;
+                int g = 0;
+                int b = 0;
+                int a = -1; // -1 if format has no alpha, in which case pixels are opaque
+            };
+
+            typedef void (*RowFunction)(const uint8_t* source, olc::Pixel* dest, int width, const Layout& layout);
+
+            static Layout GetLayout(AVPixelFormat format);
+            static RowFunction GetRowFunction();
+            // Converts pixels from "begin" to "end"
+            static void ConvertPixels(const uint8_t* source, olc::Pixel* dest, int begin, int end, const Layout& layout);
+            static void ConvertRowScalar(const uint8_t* source, olc::Pixel* dest, int width, const Layout& layout);
+
+#ifdef OLC_MEDIA_X86
+            OLC_MEDIA_TARGET("ssse3") static void ConvertRowSSSE3(const uint8_t* source, olc::Pixel* dest, int width, const Layout& layout);
+#endif // OLC_MEDIA_X86
+
+#ifdef OLC_MEDIA_NEON
+            static void ConvertRowNEON(const uint8_t* source, olc::Pixel* dest, int width, const Layout& layout);
+#endif // OLC_MEDIA_NEON
+        };
+
+        // Pool of threads, that split a single job into bands and run them in parallel.
+        // Thread that calls "run()" works on the bands too, so only "thread_count - 1" threads are created.
+        class BandWorkers {
+        public:
+            void start(size_t thread_count);
+            void stop();
+
+            // Amount of threads that work on bands, including the caller
+            size_t thread_count() const;
+
+            // Calls "job(band)" for every band from 0 to "band_count" and returns once all of them are done.
+            // Should only be called by a single thread at a time.
+            void run(size_t band_count, const std::function<void(size_t)>& job);
+
+        private:
+            std::vector<std::thread> _threads;
+            std::mutex _mutex; // Guards everything below, except "_next_band"
+            std::condition_variable _job_available;
+            std::condition_variable _job_done;
+            const std::function<void(size_t)>* _job = nullptr;
+            size_t _band_count = 0;
+            size_t _finished_bands = 0;
+            size_t _busy_threads = 0; // Threads that might still claim bands of the current job
+            uint64_t _generation = 0; // Increased for every job
+            bool _stopping = false;
+            std::atomic<size_t> _next_band = 0;
+
+            void worker_thread();
+            // Runs bands until none are left, and returns how many were run
+            size_t run_bands(const std::function<void(size_t)>& job, size_t band_count);
+        };
+
+        // Thread safe queue of demuxed packets that are waiting to be decoded.
+        // Every seek starts a new serial with "flush()", which lets the decoder know, that it has to
+        // flush its state before decoding the following packets.
+        class PacketQueue {
         private:
-            AVAudioFifo* _fifo = nullptr;
+            std::queue<AVPacket*> _packets;
+            size_t _bytes = 0;
+            bool _finished = false; // True when demuxer won't push any more packets
+            int _serial = 0;
+            double _seek_target = -1.0; // Timepoint decoder should skip to after the latest flush. Negative if there is none.
+
             mutable std::mutex _mut;
 
         public:
-            AudioQueue() {
+            PacketQueue() {
             }
 
-            ~AudioQueue() {
+            ~PacketQueue() {
                 clear();
-                free();
             }
 
-            // Suggested to set capacity to sample rate
-            Result init(AVSampleFormat format, int channels, int capacity) {
-                // If these parameters are 0, there is something wrong
-                if (capacity == 0 || channels == 0)
+            // Moves packet reference into the queue
+            Result push(AVPacket* packet) {
+                AVPacket* queued_packet = av_packet_alloc();
+                if (queued_packet == nullptr)
                     return Result::Error;
 
-                if (_fifo != nullptr) {
-                    clear();
-                    free();
-                }
-
-                _fifo = av_audio_fifo_alloc(format, channels, capacity);
+                av_packet_move_ref(queued_packet, packet);
 
-                if (_fifo == nullptr)
-                    return Result::Error;
+                std::lock_guard<std::mutex> lock(_mut);
+                _bytes += queued_packet->size;
+                _packets.push(queued_packet);
 
                 return Result::ResSuccess;
             }
 
-            int push(void** data, int samples) {
+            // Moves the oldest packet reference into "packet".
+            // "serial" and "seek_target" are set to the ones of the latest flush, even if queue is empty.
+            // Returns false if queue is empty
+            bool pop(AVPacket* packet, int& serial, double& seek_target) {
                 std::lock_guard<std::mutex> lock(_mut);
 
-                int space = av_audio_fifo_space(_fifo);
+                serial = _serial;
+                seek_target = _seek_target;
 
-                // If capacity is reached, drain some audio samples
-                if (samples > space) {
-                    av_audio_fifo_drain(_fifo, std::min(av_audio_fifo_size(_fifo), samples - space));
-                }
+                if (_packets.empty())
+                    return false;
+
+                AVPacket* queued_packet = _packets.front();
+                _packets.pop();
+                _bytes -= queued_packet->size;
+
+                av_packet_move_ref(packet, queued_packet);
+                av_packet_free(&queued_packet);
+
+                return true;
+            }
 
-                return av_audio_fifo_write(_fifo, data, samples);
+            // Serial of the latest flush
+            int serial(double& seek_target) const {
+                std::lock_guard<std::mutex> lock(_mut);
+                seek_target = _seek_target;
+                return _serial;
+            }
+
+            // Marks that no more packets will be pushed (until "flush()" or "clear()" is called)
+            void finish() {
+                std::lock_guard<std::mutex> lock(_mut);
+                _finished = true;
             }
 
-            int pop(void** data, int samples) {
-                std::unique_lock<std::mutex> lock(_mut);
-                return av_audio_fifo_read(_fifo, data, samples);
+            // Returns true if "finish()" was called and all packets were popped
+            bool finished() const {
+                std::lock_guard<std::mutex> lock(_mut);
+                return _finished && _packets.empty();
             }
 
-            void drain(int samples) {
-                std::unique_lock<std::mutex> lock(_mut);
-                av_audio_fifo_drain(_fifo, samples);
+            size_t size() const {
+                std::lock_guard<std::mutex> lock(_mut);
+                return _packets.size();
             }
 
-            int size() {
-                std::unique_lock<std::mutex> lock(_mut);
-                return av_audio_fifo_size(_fifo);
+            // Total size of queued packet payloads
+            size_t bytes() const {
+                std::lock_guard<std::mutex> lock(_mut);
+                return _bytes;
             }
 
-            int capacity() {
-                std::unique_lock<std::mutex> lock(_mut);
-                return av_audio_fifo_space(_fifo) + av_audio_fifo_size(_fifo);
+            // Frees all the packets, resets "finished" state and starts new serial
+            void flush(int serial, double seek_target) {
+                std::lock_guard<std::mutex> lock(_mut);
+
+                while (_packets.empty() == false) {
+                    AVPacket* queued_packet = _packets.front();
+                    _packets.pop();
+                    av_packet_free(&queued_packet);
+                }
+
+                _bytes = 0;
+                _finished = false;
+                _serial = serial;
+                _seek_target = seek_target;
             }
 
-            // Empties out all the frames
+            // Frees all the packets and resets the state
             void clear() {
-                if (_fifo != nullptr)
-                    av_audio_fifo_drain(_fifo, av_audio_fifo_size(_fifo));
+                flush(0, -1.0);
             }
+        };
 
-            // De-allocates fifo structure
-            void free() {
-                av_audio_fifo_free(_fifo);
-                _fifo = nullptr;
+        // Outcome of a single step done by one of the pipeline threads
+        enum class StepResult {
+            Progressed, // Some work was done, step can be repeated right away
+            Blocked,    // Step can't continue until some other thread wakes it up
+            Finished,   // Reached the end of the stream. No more work will be available until a seek happens
+            Error,
+        };
+
+        enum class PipelineStage {
+            Demuxer,
+            VideoDecoder,
+            VideoConverter,
+            AudioDecoder,
+        };
+
+        // Runs a single pipeline stage as a task of shared "MediaExecutor"
+        class PipelineTask : public MediaExecutor::Task {
+        public:
+            Media* media = nullptr;
+            PipelineStage stage = PipelineStage::Demuxer;
+
+            MediaExecutor::TaskResult Step() override;
+            std::chrono::steady_clock::time_point Deadline() override;
+        };
+
+        // Used to wake up a pipeline thread, when the reason it was blocked on might have changed
+        struct PipelineSignal {
+            std::condition_variable conditional;
+            std::atomic<uint64_t> generation = 0; // Incremented on every wake up
+
+            // Set while the stage runs on shared executor instead of its own thread
+            MediaExecutor* executor = nullptr;
+            PipelineTask task;
+
+            // If not 0, waiting thread re-checks its step at least this often. Required for signals that are woken up
+            // with "WakePipelineStageFromRealtimeThread()", as such wake ups can be missed.
+            std::chrono::milliseconds poll_interval;
+
+            PipelineSignal(std::chrono::milliseconds poll_interval = std::chrono::milliseconds(0)) :
+                poll_interval(poll_interval)
+            {
             }
         };
 
+        // Position of a single packet in the media file
+        struct IndexEntry {
+            int64_t pts = AV_NOPTS_VALUE;
+            int64_t dts = AV_NOPTS_VALUE;
+            int64_t pos = -1; // Byte offset in the file. Negative if unknown.
+            bool keyframe = false;
+        };
+
+        // Packets of a single stream
+        struct StreamIndex {
+            std::vector<IndexEntry> packets; // In file (decoding) order
+            std::vector<size_t> keyframes;   // Indices of keyframes in "packets"
+            std::vector<int64_t> frame_pts;  // Timestamps of packets in presentation order
+        };
+
+        // What the index thread knows about a stream of the media
+        struct IndexedStreamInfo {
+            AVCodecID codec_id = AV_CODEC_ID_NONE;
+            AVRational time_base = { 0, 1 };
+        };
+
         // Platform specific IO setup for FFMPEG
         // Big thanks to Desp4
 #ifdef _WIN32
-        typedef DWORD FilePointer;
         typedef HANDLE FileHandle;
 
     public:
@@ -343,19 +1117,33 @@ namespace olc {
         };
     private:
 #else
-        typedef uint64_t FilePointer;
-        typedef FILE* FileHandle;
+        typedef int FileHandle;
     public:
         typedef const char* FileName;
     private:
 #endif // _WIN32
 
-        class IOContext {
+        class SharedFile;
+
+        // Where the media is read from: a file, a block of memory, or a custom source
+        struct MediaSource {
+            const FileName* filename = nullptr; // Only valid during "Open()"
+            std::shared_ptr<SharedFile> shared_file; // Already opened file, that is read instead of opening "filename" again
+            const uint8_t* data = nullptr;
+            size_t size = 0;
+            std::shared_ptr<const std::vector<char>> owned_data; // Keeps "data" alive, if it's owned by the media
+            std::shared_ptr<IOSource> io_source;
+        };
+
+        // File opened with the platform specific file API. Reads are done at an explicit 64-bit offset and don't move
+        // any file position, so several readers (demuxer and index thread) can share the same opened file.
+        class SharedFile {
         private:
 #ifdef _WIN32
             static FileHandle openFile(const FileName& path)
             {
-                HANDLE ret = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+                // Lets the system cache read ahead more aggressively
+                HANDLE ret = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
                 return ret != INVALID_HANDLE_VALUE ? ret : nullptr;
             }
 
@@ -364,1458 +1152,4532 @@ namespace olc {
                 return !CloseHandle(file);
             }
 
-            static bool seekFile(FileHandle file, int64_t offset, int origin)
+            static int64_t readFileAt(FileHandle file, void* buffer, int64_t size, int64_t offset)
             {
-                // Origin macros match those of fseek
-                return SetFilePointer(file, (LONG)offset, NULL, origin) == INVALID_SET_FILE_POINTER;
-            }
+                // Offset of a synchronous read is given through OVERLAPPED, instead of the shared file pointer
+                OVERLAPPED overlapped;
+                memset(&overlapped, 0, sizeof(overlapped));
+                overlapped.Offset = DWORD(uint64_t(offset) & 0xFFFFFFFF);
+                overlapped.OffsetHigh = DWORD(uint64_t(offset) >> 32);
 
-            static FilePointer readFile(FileHandle file, void* buffer, FilePointer size)
-            {
                 DWORD len;
-                return ReadFile(file, buffer, size, &len, NULL) != 0 ? len : 0;
+                if (ReadFile(file, buffer, DWORD(std::min<int64_t>(size, MAXDWORD)), &len, &overlapped) != 0)
+                    return int64_t(len);
+
+                return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
             }
 
-            static FilePointer filePos(FileHandle file)
+            static int64_t readFileAvailable(FileHandle file, void* buffer, int64_t size)
             {
-                return SetFilePointer(file, 0, NULL, FILE_CURRENT);
-            }
+                // Pipes already return as soon as any data is available
+                DWORD len;
+                if (ReadFile(file, buffer, DWORD(std::min<int64_t>(size, MAXDWORD)), &len, NULL) != 0)
+                    return int64_t(len);
 
-#else
+                // Writer closed the pipe
+                return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+            }
 
-            static FileHandle openFile(const FileName& path)
+            static int64_t fileSize(FileHandle file)
             {
-                return fopen(path, "rb");
+                LARGE_INTEGER size;
+                return GetFileSizeEx(file, &size) ? int64_t(size.QuadPart) : -1;
             }
 
-            static bool closeFile(FileHandle file)
+            static void adviseSequential(FileHandle /*file*/)
             {
-                return fclose(file);
+                // Done with FILE_FLAG_SEQUENTIAL_SCAN when the file is opened
             }
 
-            static bool seekFile(FileHandle file, int64_t offset, int origin)
+            static int64_t fileModificationTime(const FileName& path)
             {
-                return fseek(file, offset, origin);
+                WIN32_FILE_ATTRIBUTE_DATA data;
+                if (GetFileAttributesExW(path, GetFileExInfoStandard, &data) == 0)
+                    return 0;
+
+                return int64_t((uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime);
             }
 
-            static FilePointer readFile(FileHandle file, void* buffer, FilePointer size)
+#else
+
+            static FileHandle openFile(const FileName& path)
             {
-                return fread(buffer, 1, size, file);
+                return ::open(path, O_RDONLY);
             }
 
-            static FilePointer filePos(FileHandle file)
+            static bool closeFile(FileHandle file)
             {
-                return ftell(file);
+                return ::close(file) != 0;
             }
 
-#endif // _WIN32
-
-        public:
-            // Recommended buffer size for i/o contexts by ffmpeg docs
-            IOContext(uint64_t buffersize = 4096) :
-                bufferSize(buffersize),
-                buffer(static_cast<uint8_t*>(av_malloc(buffersize)))
+            static int64_t readFileAt(FileHandle file, void* buffer, int64_t size, int64_t offset)
             {
+                ssize_t len;
+                do {
+                    len = pread(file, buffer, size_t(size), off_t(offset));
+                } while (len < 0 && errno == EINTR);
+
+                return int64_t(len);
             }
 
-            ~IOContext()
+            static int64_t readFileAvailable(FileHandle file, void* buffer, int64_t size)
             {
-                closeIO();
-                if (buffer)
-                    av_freep(&buffer);
+                ssize_t len;
+                do {
+                    len = ::read(file, buffer, size_t(size));
+                } while (len < 0 && errno == EINTR);
+
+                return int64_t(len);
             }
 
-            // Returns true on success
-            bool initAVFmtCtx(const FileName& filename, AVFormatContext* fmtCtx)
+            static int64_t fileSize(FileHandle file)
             {
-                closeIO();
-                file = openFile(filename);
+                struct stat info;
+                if (fstat(file, &info) != 0 || S_ISREG(info.st_mode) == false)
+                    return -1;
 
-                if (!file)
-                    return false;
+                return int64_t(info.st_size);
+            }
 
-                ioCtx = avio_alloc_context(
-                    buffer,         // Internal buffer
-                    (int)bufferSize,     // Buffer size
-                    0,              // Write flag(1=true, 0=false) 
-                    this,           // User data, will be passed to the callback functions
-                    ioread,         // Read callback
-                    nullptr,        // No write callback
-                    ioseek);        // Seek callback
+            static void adviseSequential(FileHandle file)
+            {
+                // Lets the kernel read ahead more aggressively
+                posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+            }
 
+            static int64_t fileModificationTime(const FileName& path)
+            {
+                struct stat info;
+                if (stat(path, &info) != 0)
+                    return 0;
 
-                fmtCtx->pb = ioCtx;
-                fmtCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+                return int64_t(info.st_mtime);
+            }
 
-                // Read the file and let ffmpeg guess it.
-                FilePointer len = readFile(file, buffer, (FilePointer)bufferSize);
-                if (!len)
-                    return false;
+#endif // _WIN32
 
-                // Seek to the beginning.
-                seekFile(file, 0, SEEK_SET);
+        public:
+            SharedFile() = default;
+            SharedFile(const SharedFile&) = delete;
+            SharedFile& operator=(const SharedFile&) = delete;
 
-                // Set up a probe.
-                AVProbeData probeData;
-                probeData.buf = buffer;
-                probeData.buf_size = len;
-                probeData.filename = "";
-                probeData.mime_type = NULL;
+            ~SharedFile()
+            {
+                if (isOpen)
+                    closeFile(file);
+            }
 
-                fmtCtx->iformat = av_probe_input_format(&probeData, 1);
+            // Returns true on success
+            bool open(const FileName& filename)
+            {
+                file = openFile(filename);
+#ifdef _WIN32
+                isOpen = file != nullptr;
+#else
+                isOpen = file >= 0;
+#endif // _WIN32
+                if (isOpen == false)
+                    return false;
 
+                adviseSequential(file);
                 return true;
             }
 
-            void closeIO()
+            // Reads up to "size" bytes at "offset". Can be called by several threads at the same time.
+            // Returns amount of bytes read, 0 at the end of file and negative value on error.
+            int64_t readAt(uint8_t* buffer, int64_t size, int64_t offset)
             {
-                if (file)
-                {
-                    closeFile(file);
-                    file = nullptr;
-                }
-                if (ioCtx)
-                    avio_context_free(&ioCtx);
+                return readFileAt(file, buffer, size, offset);
             }
 
-        protected:
-            static int ioread(void* data, uint8_t* buf, int bufSize)
+            // Reads whatever is available at the file position. Used for pipes, which can't be read at an offset.
+            int64_t readAvailable(uint8_t* buffer, int64_t size)
             {
-                IOContext* thisio = reinterpret_cast<IOContext*>(data);
-                FilePointer len = readFile(thisio->file, buf, bufSize);
-                if (!len)
-                    return AVERROR_EOF; // Probably reached EOF, let ffmpeg know.
-                return len;
+                return readFileAvailable(file, buffer, size);
             }
 
-            // Whence: SEEK_SET, SEEK_CUR, SEEK_END and AVSEEK_SIZE
-            static int64_t ioseek(void* data, int64_t pos, int whence)
+            // Returns size of the file, or negative value if it's unknown
+            int64_t size()
             {
-                if (whence == AVSEEK_SIZE)
-                    return -1; // Don't support - return a negative.
-
-                IOContext* thisio = reinterpret_cast<IOContext*>(data);
-                if (seekFile(thisio->file, pos, whence))
-                    return -1;
+                return fileSize(file);
+            }
 
-                return filePos(thisio->file);
+            // Returns the time the file was last written to, in platform specific units, or 0 if it's unknown
+            static int64_t modificationTime(const FileName& path)
+            {
+                return fileModificationTime(path);
             }
 
         private:
-            uint8_t* buffer;
-            uint64_t bufferSize;
-            AVIOContext* ioCtx = nullptr;
-            FileHandle file = nullptr;
+            FileHandle file;
+            bool isOpen = false;
         };
 
-    private:
-        // -- Private internal state --
-        AVFormatContext* av_format_ctx = nullptr;
-        IOContext ioCtx;
+        class IOContext {
+            friend struct MediaTestAccess;
 
-        Settings settings;
+        private:
+            // Source of the media file bytes
+            class Backend {
+            public:
+                virtual ~Backend() = default;
+
+                // Reads up to "size" bytes at the current position.
+                // Returns amount of bytes read, 0 at the end of file and negative value on error.
+                virtual int64_t read(uint8_t* buffer, int64_t size) = 0;
+
+                // Whence: SEEK_SET, SEEK_CUR and SEEK_END
+                // Returns the new position, or negative value on error.
+                virtual int64_t seek(int64_t offset, int whence) = 0;
+
+                // Returns size of the file, or negative value if it's unknown
+                virtual int64_t size() = 0;
+            };
+
+            // Reads file in chunks with its own position, so that the file can be shared with other contexts
+            class BufferedBackend : public Backend {
+            public:
+                // Live file returns whatever is available at the file position, instead of reading at an offset
+                BufferedBackend(std::shared_ptr<SharedFile> shared_file, bool live_file) :
+                    file(std::move(shared_file)),
+                    live(live_file)
+                {
+                }
 
-        bool is_paused;
+                int64_t read(uint8_t* buffer, int64_t size) override
+                {
+                    int64_t len = live ? file->readAvailable(buffer, size) : file->readAt(buffer, size, position);
+                    if (len > 0)
+                        position += len;
 
-        // If false, video capture wasn't opened, or last frame was put into queue
-        std::atomic<bool> finished_reading = false;
+                    return len;
+                }
 
-        // When true, the frame loading thread keeps on working
-        // When set to false, and conditional is called, frame loading thread is halted
-        std::atomic<bool> keep_loading = true;
-        
-        std::thread frame_loader;
-        std::mutex mutex;
-        std::condition_variable conditional;
+                int64_t seek(int64_t offset, int whence) override
+                {
+                    int64_t new_position;
+                    switch (whence) {
+                    case SEEK_SET: new_position = offset; break;
+                    case SEEK_CUR: new_position = position + offset; break;
+                    case SEEK_END: {
+                        int64_t file_size = file->size();
+                        if (file_size < 0)
+                            return -1;
+
+                        new_position = file_size + offset;
+                        break;
+                    }
+                    default: return -1;
+                    }
 
-        
-        // -- Video stuff --
-        int video_stream_index = -1;
-        AVRational video_time_base;
-        VideoQueue video_fifo;
-        const AVCodec* av_video_codec = nullptr;
-        AVCodecContext* av_video_codec_ctx = nullptr;
-        SwsContext* sws_video_scaler_ctx = nullptr;
-        AVFrame* temp_video_frame = nullptr; // Used to temporary store converted video frame
-        olc::Renderable video_frame;
-        int video_width = 0;
-        int video_height = 0;
-        int video_delay = 0;
-        float delta_time_accumulator = 0.0f;
-        double last_video_pts = 0.0;
-        bool video_opened = false;
-        bool attached_pic = false; // True if video stream is a single attached picture (for example album art in mp3 metadata)
+                    if (new_position < 0)
+                        return -1;
 
-        // -- Audio stuff --
-        int audio_stream_index = -1;
-        AVRational audio_time_base;
-        AudioQueue audio_fifo;
-        const AVCodec* av_audio_codec = nullptr;
-        AVCodecContext* av_audio_codec_ctx = nullptr;
-        SwrContext* swr_audio_resampler = nullptr;
-        size_t audio_frames_consumed = 0;
-        std::atomic<double> audio_time = 0.0;
-        AVSampleFormat audio_format;
-        int audio_sample_size = 0;
-        int audio_sample_rate = 0;
-        int audio_channel_count = 0;
-        // Default volume is 1 (max) for miniaud.io, so it's better to have video playing quieter than louder
-        float audio_volume = 0.5f;
-        bool audio_opened = false;
+                    position = new_position;
+                    return position;
+                }
 
-#ifndef OLC_MEDIA_CUSTOM_AUDIO_PLAYBACK
-        ma_device audio_device;
-#endif //OLC_MEDIA_CUSTOM_AUDIO_PLAYBACK
+                int64_t size() override
+                {
+                    return file->size();
+                }
 
-	public:
-        Media();
-        ~Media();
+            private:
+                std::shared_ptr<SharedFile> file;
+                bool live = false;
+                int64_t position = 0;
+            };
+
+            // Waits for more data when the source runs out of it, instead of reporting the end right away.
+            // Used for live input, which can't be seeked.
+            class TailFollowBackend : public Backend {
+            public:
+                TailFollowBackend(std::unique_ptr<Backend> source_backend, double timeout, const std::atomic<bool>& interrupted) :
+                    source(std::move(source_backend)),
+                    timeout(timeout),
+                    interrupted(interrupted)
+                {
+                }
 
-        // -- Video and audio functions --
+                int64_t read(uint8_t* buffer, int64_t size) override
+                {
+                    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
 
-        // If media is already open, closes it first.
-        // - preloaded_frames_scale: Affects how many seconds of pre-decoded video/audio frames should be stored. (only suggested to 
-        //   increase it, when you notice that some of your video/audio frames are skipped).
-        // - settings: Playback settings. Pass nullptr to use default settings.
-        // NOTE: You shouldn't use this class to load static image formats as they most likely won't work (such as ".jpg" or ".png")
-        Result Open(const std::string& filename, bool open_video, bool open_audio, Settings* settings);
+                    while (true) {
+                        int64_t len = source->read(buffer, size);
+                        if (len != 0)
+                            return len;
 
-#ifdef _WIN32
-        // Windows exclusive function, because windows allows filenames to have unicode characters.
-        Result Open(const std::wstring& filename, bool open_video, bool open_audio, Settings* settings);
-#endif // _WIN32
+                        if (interrupted || std::chrono::steady_clock::now() >= deadline)
+                            return 0;
 
-        // If media is currently open, closes it and frees up all the resources.
-        void Close();
+                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    }
+                }
 
-        // Returns true if any of the following is true:
-        // - Media file wasn't opened;
-        // - No more frames are available in the media file;
-        // - Error occured when trying to receive a packet.
-        bool FinishedReading();
+                int64_t seek(int64_t /*offset*/, int /*whence*/) override
+                {
+                    return -1;
+                }
 
-        // If media was playing, pauses it.
-        // Does nothing if media isn't open.
-        void Pause();
+                int64_t size() override
+                {
+                    // Size keeps changing while the data is being written
+                    return -1;
+                }
 
-        // If media was paused, continues playing it.
-        // Does nothing if media isn't open.
-        void Play();
+            private:
+                std::unique_ptr<Backend> source;
+                double timeout;
+                const std::atomic<bool>& interrupted;
+            };
+
+            // Reads ahead of the consumer on a background thread, into a ring buffer of "capacity" bytes.
+            // Consumer only waits when it gets ahead of the reader, or seeks outside of the buffered data.
+            class ReadaheadBackend : public Backend {
+            public:
+                ReadaheadBackend(std::unique_ptr<Backend> source_backend, size_t capacity) :
+                    source(std::move(source_backend)),
+                    ring(capacity)
+                {
+                    // Source is only used by the reader thread from now on
+                    fileSize = source->size();
+                    position = source->seek(0, SEEK_CUR);
+                    if (position < 0)
+                        position = 0;
+                    bufferStart = position;
+                    bufferEnd = position;
+
+                    reader = std::thread(&ReadaheadBackend::readerThread, this);
+                }
 
-        // Returns true if media is currently paused.
-        bool IsPaused();
+                ~ReadaheadBackend()
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        stopping = true;
+                    }
+                    readerWake.notify_one();
+                    reader.join();
+                }
 
-        // Seeks the media file to specified timepoint.
-        // - new_time: wanted timestamp in seconds
-        Result Seek(double new_time);
+                int64_t read(uint8_t* buffer, int64_t size) override
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
 
-        // Returns current position in media that is being played.
-        // If media isn't open, returns 0.0
-        double GetCurrentPlaybackTime();
+                    while (position < bufferStart || position >= bufferEnd) {
+                        // Reader doesn't read past the end of file, so position right at the end is still "buffered"
+                        if (position == bufferEnd && restartPosition < 0 && (endOfFile || failed))
+                            return failed ? -1 : 0;
 
+                        if ((position < bufferStart || position > bufferEnd) && restartPosition != position) {
+                            restartPosition = position;
+                            readerWake.notify_one();
+                        }
 
-        // -- Video functions --
-        
-        // Returns next video frame, unless media is paused.
-        // When only video is playing, delta_time is used to synchronise the video.
-        // If video is played together with audio, delta_time is ignored, and video is synchronised based on
-        // how many audio frames were consumed.
-        // If media was paused before a single video frame could be decoded, the returned frame might be empty.
-        // 
-        // NOTE: Returned decal's pixel data might change when you call one of "GetVideoFrame" functions again.
-        olc::Decal* GetVideoFrame(float delta_time);
+                        dataReady.wait(lock);
+                    }
 
-        // Returns next video frame even when media is paused.
-        // 
-        // NOTE: Returned decal's pixel data might change when you call one of "GetVideoFrame" functions again.
-        // NOTE: Only use this function, if you want to implement video synchronisation yourself.
-        olc::Decal* GetVideoFrame();
+                    // Reader only writes outside of the range between "bufferStart" and "bufferEnd", and doesn't
+                    // reclaim bytes after "position", so data can be copied without holding the lock
+                    int64_t len = std::min(size, bufferEnd - position);
+                    int64_t copy_position = position;
+                    lock.unlock();
 
-        // Pops video frame from the internal queue.
-        // If one of the following is true, function does nothing and returns Error enum:
-        // - Video wasn't opened;
-        // - No more frames are avialable in the video;
-        // - Decoder didn't decode a frame yet.
-        // 
-        // NOTE: Only use this function, if you want to implement video synchronisation yourself.
-        Result SkipVideoFrame();
+                    size_t capacity = ring.size();
+                    size_t offset = size_t(copy_position % int64_t(capacity));
+                    size_t first = std::min(size_t(len), capacity - offset);
+                    memcpy(buffer, ring.data() + offset, first);
+                    memcpy(buffer + first, ring.data(), size_t(len) - first);
 
-        // Returns true if video was sucessfully opened with "Open()" function and "Close()" wasn't called.
-        bool IsVideoOpened();
+                    lock.lock();
+                    position += len;
+                    lock.unlock();
 
-        // Not all videos have frames of equal length, so FPS can only be average.
-        double GetAverageVideoFPS();
+                    // Reader might be waiting for space
+                    readerWake.notify_one();
 
-        // Prints video info to console.
-        // 
-        // NOTE: The printed information can change between versions.
-        void PrintVideoInfo();
+                    return len;
+                }
 
-        
-		//bool seek_frame(int64_t ts);
-		
+                int64_t seek(int64_t offset, int whence) override
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+
+                    int64_t new_position;
+                    switch (whence) {
+                    case SEEK_SET: new_position = offset; break;
+                    case SEEK_CUR: new_position = position + offset; break;
+                    case SEEK_END:
+                        if (fileSize < 0)
+                            return -1;
+                        new_position = fileSize + offset;
+                        break;
+                    default: return -1;
+                    }
 
-        // -- Audio functions --
-        // Returns amount of samples that were read (if not all samples were written, the rest will be filled with 0s (silence))
-        // or -1 if an error occured due to bad parameters or other reasons.
-        // output: pointer to byte array pointed by "void*", where the byte array size must be "channel_count * sample_count * sample_size".
-        // entire outptu buffer will be filled with silence by default.
-        // 
-        // NOTE: Only use this function if you intend to play the audio yourself. If you do decide to handle audio yourself,
-        // note, that when video and audio is played together, video is synchronised according to how many audio samples have been read.
-        int GetAudioFrame(void** output, int sample_count);
+                    if (new_position < 0)
+                        return -1;
 
-        // Returns true if audio was sucessfully opened with "Open()" function and "Close()" wasn't called.
-        bool IsAudioOpened();
+                    // Reader is restarted by "read()", if new position isn't buffered
+                    position = new_position;
+                    return position;
+                }
 
-        // Prints audio info to console.
-        // 
-        // NOTE: The printed information can change between versions.
-        void PrintAudioInfo();
+                int64_t size() override
+                {
+                    return fileSize;
+                }
 
-        // If audio isn't opened, does nothing.
-        // new_volume: value between 0 (silence) and 1 (full volume). The value is clamped if it exceeds bounds.
-        //
-        // NOTE: This doesn't affect audio output frame volume when using your own audio backend.
-        void SetAudioVolume(float new_volume);
+            private:
+                // Maximum amount of bytes read at once
+                static constexpr size_t chunkSize = 256 * 1024;
+
+                std::unique_ptr<Backend> source;
+                std::vector<uint8_t> ring;
+                int64_t fileSize = -1;
+
+                std::mutex mutex; // Guards everything below
+                std::condition_variable dataReady;
+                std::condition_variable readerWake;
+                int64_t position = 0;       // Position of the consumer
+                int64_t bufferStart = 0;    // File position of the oldest byte in "ring"
+                int64_t bufferEnd = 0;      // File position after the newest byte in "ring"
+                int64_t restartPosition = -1; // Position reader has to continue from, or -1
+                bool endOfFile = false;
+                bool failed = false;
+                bool stopping = false;
+                std::thread reader;
+
+                void readerThread()
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+
+                    while (stopping == false) {
+                        if (restartPosition >= 0) {
+                            int64_t new_position = restartPosition;
+                            restartPosition = -1;
+                            bufferStart = new_position;
+                            bufferEnd = new_position;
+                            endOfFile = false;
+                            failed = false;
+
+                            lock.unlock();
+                            bool sought = source->seek(new_position, SEEK_SET) == new_position;
+                            lock.lock();
+
+                            if (sought == false && restartPosition < 0) {
+                                failed = true;
+                                dataReady.notify_one();
+                            }
+                            continue;
+                        }
 
-        // Returns value between 0 (silence) and 1 (full volume). The value is clamped if it exceeds bounds.
-        // If audio isn't open, returns 0.
-        //
-        // NOTE: This doesn't affect audio output frame volume when using your own audio backend.
-        float GetAudioVolume();
+                        // Bytes before the consumer are reclaimed once there is no more space, except for a quarter
+                        // of the buffer, which is left for short seeks backwards
+                        int64_t capacity = int64_t(ring.size());
+                        int64_t keep_behind = capacity / 4;
+                        if (bufferEnd - bufferStart >= capacity)
+                            bufferStart = std::max(bufferStart, std::min(position - keep_behind, bufferEnd));
+
+                        // Nothing to do until consumer reads more, seeks or the media is closed
+                        if (endOfFile || failed || bufferEnd - bufferStart >= capacity || position < bufferStart) {
+                            readerWake.wait(lock);
+                            continue;
+                        }
 
-        // Returns audio format that will be converted (if needed) and stored when reading audio data, that 
-        // you can expect to get from "GetAudioFrame()" function.
-        // If audio isn't open, returns AV_SAMPLE_FMT_NONE.
-        AVSampleFormat GetAudioOutputFormat();
+                        int64_t read_position = bufferEnd;
+                        size_t offset = size_t(read_position % capacity);
+                        size_t len = std::min({ chunkSize, size_t(capacity - (bufferEnd - bufferStart)), size_t(capacity) - offset });
 
-        // Returns original audio format that was stored in the media.
-        // If audio isn't open, returns AV_SAMPLE_FMT_NONE.
-        AVSampleFormat GetAudioOriginalFormat();
+                        lock.unlock();
+                        int64_t read = source->read(ring.data() + offset, int64_t(len));
+                        lock.lock();
 
-        // Returns 
+                        // Data is thrown away, if consumer sought somewhere else in the meantime
+                        if (restartPosition >= 0 || read_position != bufferEnd)
+                            continue;
+
+                        if (read > 0)
+                            bufferEnd += read;
+                        else if (read == 0)
+                            endOfFile = true;
+                        else
+                            failed = true;
+
+                        dataReady.notify_one();
+                    }
+                }
+            };
+
+#ifndef _WIN32
+            // Maps the whole file into memory, so reads are only copies from the mapping.
+            // Kernel is told which part of the file will be read next, so that it's loaded ahead of time.
+            class MemoryMappedBackend : public Backend {
+            public:
+                ~MemoryMappedBackend()
+                {
+                    if (mapping != nullptr)
+                        munmap(mapping, size_t(fileSize));
+                }
+
+                // Returns true on success
+                bool open(const FileName& filename)
+                {
+                    int fd = ::open(filename, O_RDONLY);
+                    if (fd < 0)
+                        return false;
+
+                    // Empty files and special files (pipes, etc.) can't be mapped
+                    struct stat info;
+                    if (fstat(fd, &info) != 0 || S_ISREG(info.st_mode) == false || info.st_size <= 0) {
+                        ::close(fd);
+                        return false;
+                    }
+
+                    fileSize = int64_t(info.st_size);
+                    void* result = mmap(nullptr, size_t(fileSize), PROT_READ, MAP_PRIVATE, fd, 0);
+
+                    // Mapping keeps the file open by itself
+                    ::close(fd);
+
+                    if (result == MAP_FAILED)
+                        return false;
+
+                    mapping = static_cast<uint8_t*>(result);
+                    pageSize = int64_t(sysconf(_SC_PAGESIZE));
+                    if (pageSize <= 0)
+                        pageSize = 4096;
+
+                    // Media is mostly read from start to end
+                    madvise(mapping, size_t(fileSize), MADV_SEQUENTIAL);
+
+                    return true;
+                }
+
+                int64_t read(uint8_t* buffer, int64_t size) override
+                {
+                    int64_t len = std::min(size, fileSize - position);
+                    if (len <= 0)
+                        return 0;
+
+                    adviseReadahead();
+                    memcpy(buffer, mapping + position, size_t(len));
+                    position += len;
+
+                    return len;
+                }
+
+                int64_t seek(int64_t offset, int whence) override
+                {
+                    int64_t new_position;
+                    switch (whence) {
+                    case SEEK_SET: new_position = offset; break;
+                    case SEEK_CUR: new_position = position + offset; break;
+                    case SEEK_END: new_position = fileSize + offset; break;
+                    default: return -1;
+                    }
+
+                    if (new_position < 0)
+                        return -1;
+
+                    // Readahead continues from the new position, unless it was already requested
+                    if (new_position < position || new_position > advisedEnd)
+                        advisedEnd = new_position;
+
+                    position = new_position;
+                    return position;
+                }
+
+                int64_t size() override
+                {
+                    return fileSize;
+                }
+
+            private:
+                // Bytes ahead of the current position, that kernel is asked to load
+                static constexpr int64_t readaheadBytes = 4 * 1024 * 1024;
+
+                uint8_t* mapping = nullptr;
+                int64_t fileSize = 0;
+                int64_t position = 0;
+                int64_t advisedEnd = 0; // End of the range kernel was last asked to load
+                int64_t pageSize = 4096;
+
+                // Asks to load the next part of the file, once half of the previously requested part was read
+                void adviseReadahead()
+                {
+                    if (position + readaheadBytes / 2 < advisedEnd || advisedEnd >= fileSize)
+                        return;
+
+                    // Address must be aligned to page size
+                    int64_t begin = std::max(position, advisedEnd) / pageSize * pageSize;
+                    int64_t end = std::min(position + readaheadBytes, fileSize);
+                    if (begin < end)
+                        madvise(mapping + begin, size_t(end - begin), MADV_WILLNEED);
+
+                    advisedEnd = end;
+                }
+            };
+#endif // _WIN32
+
+#ifdef OLC_MEDIA_IO_URING
+            // Keeps reads of the next parts of the file in flight with io_uring, and serves reads from the completed ones,
+            // so that the demuxer only waits when it gets ahead of the disk. Reads are kept in a ring of slots, ordered by
+            // file offset, and the current position is always inside of the first slot.
+            class IoUringBackend : public Backend {
+            public:
+                ~IoUringBackend()
+                {
+                    // Kernel might still be writing into the buffers, so they are leaked if the reads can't be waited for
+                    while (inFlight > 0) {
+                        if (waitForCompletion() == false) {
+                            for (Slot& slot : slots) {
+                                if (slot.inFlight)
+                                    slot.buffer.release();
+                            }
+                            break;
+                        }
+                    }
+
+                    if (sqes != nullptr)
+                        munmap(sqes, sqesSize);
+                    if (cqRing != nullptr)
+                        munmap(cqRing, cqRingSize);
+                    if (sqRing != nullptr)
+                        munmap(sqRing, sqRingSize);
+                    if (ringFd >= 0)
+                        ::close(ringFd);
+                    if (fd >= 0)
+                        ::close(fd);
+                }
+
+                // Returns true on success
+                bool open(const FileName& filename, unsigned reads_in_flight)
+                {
+                    fd = ::open(filename, O_RDONLY);
+                    if (fd < 0)
+                        return false;
+
+                    // Reads are planned from the file size, so special files (pipes, etc.) aren't supported
+                    struct stat info;
+                    if (fstat(fd, &info) != 0 || S_ISREG(info.st_mode) == false || info.st_size <= 0)
+                        return false;
+
+                    fileSize = int64_t(info.st_size);
+
+                    if (setupRing(reads_in_flight) == false)
+                        return false;
+
+                    slots.resize(reads_in_flight);
+                    for (Slot& slot : slots)
+                        slot.buffer.reset(new uint8_t[chunkSize]);
+
+                    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+                    return submitReads();
+                }
+
+                int64_t read(uint8_t* buffer, int64_t size) override
+                {
+                    if (position >= fileSize)
+                        return 0;
+
+                    Slot& slot = slots[head];
+                    while (slot.inFlight) {
+                        if (waitForCompletion() == false)
+                            return -1;
+                    }
+
+                    if (slot.error != 0)
+                        return -1;
+
+                    // File might have been truncated since it was opened
+                    int64_t available = slot.offset + slot.length - position;
+                    if (available <= 0)
+                        return 0;
+
+                    int64_t len = std::min(size, available);
+                    memcpy(buffer, slot.buffer.get() + (position - slot.offset), size_t(len));
+                    position += len;
+
+                    if (position >= slot.offset + slot.length) {
+                        if (recycleHead() == false || submitReads() == false)
+                            return -1;
+                    }
+
+                    return len;
+                }
+
+                int64_t seek(int64_t offset, int whence) override
+                {
+                    int64_t new_position;
+                    switch (whence) {
+                    case SEEK_SET: new_position = offset; break;
+                    case SEEK_CUR: new_position = position + offset; break;
+                    case SEEK_END: new_position = fileSize + offset; break;
+                    default: return -1;
+                    }
+
+                    if (new_position < 0)
+                        return -1;
+
+                    // Reads that are still ahead of the new position are kept, all the others are dropped
+                    bool inside_queued = queued > 0 && new_position >= slots[head].offset && new_position < nextOffset;
+                    while (queued > 0 && (inside_queued == false || slots[head].offset + slots[head].requested <= new_position)) {
+                        if (recycleHead() == false)
+                            return -1;
+                    }
+
+                    if (queued == 0)
+                        nextOffset = new_position;
+
+                    position = new_position;
+                    if (submitReads() == false)
+                        return -1;
+
+                    return position;
+                }
+
+                int64_t size() override
+                {
+                    return fileSize;
+                }
+
+            private:
+                static constexpr int64_t chunkSize = 256 * 1024;
+
+                struct Slot {
+                    std::unique_ptr<uint8_t[]> buffer;
+                    iovec iov;
+                    int64_t offset = 0;
+                    int64_t length = 0;    // Bytes read so far
+                    int64_t requested = 0; // Bytes that should be read
+                    int error = 0;
+                    bool inFlight = false;
+                };
+
+                int fd = -1;
+                int64_t fileSize = 0;
+                int64_t position = 0;
+
+                std::vector<Slot> slots;
+                size_t head = 0;        // Slot that contains the current position
+                size_t queued = 0;      // Slots that were submitted, starting from "head"
+                int64_t nextOffset = 0; // Offset of the next read that is submitted
+                unsigned inFlight = 0;
+                unsigned pendingSubmit = 0; // Reads that were added to the submission queue, but kernel wasn't told yet
+
+                int ringFd = -1;
+                void* sqRing = nullptr;
+                void* cqRing = nullptr;
+                io_uring_sqe* sqes = nullptr;
+                size_t sqRingSize = 0;
+                size_t cqRingSize = 0;
+                size_t sqesSize = 0;
+
+                unsigned* sqTail = nullptr;
+                unsigned* sqMask = nullptr;
+                unsigned* sqArray = nullptr;
+                unsigned* cqHead = nullptr;
+                unsigned* cqTail = nullptr;
+                unsigned* cqMask = nullptr;
+                io_uring_cqe* cqes = nullptr;
+
+                bool setupRing(unsigned entries)
+                {
+                    io_uring_params params;
+                    memset(&params, 0, sizeof(params));
+
+                    // Fails on kernels older than 5.1, or when io_uring is disabled
+                    ringFd = int(syscall(__NR_io_uring_setup, entries, &params));
+                    if (ringFd < 0)
+                        return false;
+
+                    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+                    void* sq = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+                    if (sq == MAP_FAILED)
+                        return false;
+                    sqRing = sq;
+
+                    void* cq = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+                    if (cq == MAP_FAILED)
+                        return false;
+                    cqRing = cq;
+
+                    void* entries_memory = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+                    if (entries_memory == MAP_FAILED)
+                        return false;
+                    sqes = static_cast<io_uring_sqe*>(entries_memory);
+
+                    uint8_t* sq_bytes = static_cast<uint8_t*>(sqRing);
+                    sqTail = reinterpret_cast<unsigned*>(sq_bytes + params.sq_off.tail);
+                    sqMask = reinterpret_cast<unsigned*>(sq_bytes + params.sq_off.ring_mask);
+                    sqArray = reinterpret_cast<unsigned*>(sq_bytes + params.sq_off.array);
+
+                    uint8_t* cq_bytes = static_cast<uint8_t*>(cqRing);
+                    cqHead = reinterpret_cast<unsigned*>(cq_bytes + params.cq_off.head);
+                    cqTail = reinterpret_cast<unsigned*>(cq_bytes + params.cq_off.tail);
+                    cqMask = reinterpret_cast<unsigned*>(cq_bytes + params.cq_off.ring_mask);
+                    cqes = reinterpret_cast<io_uring_cqe*>(cq_bytes + params.cq_off.cqes);
+
+                    return true;
+                }
+
+                // Submits reads into all the free slots
+                bool submitReads()
+                {
+                    while (queued < slots.size() && nextOffset < fileSize) {
+                        size_t index = (head + queued) % slots.size();
+                        Slot& slot = slots[index];
+                        slot.offset = nextOffset;
+                        slot.length = 0;
+                        slot.requested = std::min(chunkSize, fileSize - nextOffset);
+                        slot.error = 0;
+                        pushRead(index);
+
+                        nextOffset += slot.requested;
+                        queued++;
+                    }
+
+                    return pendingSubmit == 0 || enter(0, 0);
+                }
+
+                // Adds a read of the rest of the slot into the submission queue
+                void pushRead(size_t index)
+                {
+                    Slot& slot = slots[index];
+                    slot.iov.iov_base = slot.buffer.get() + slot.length;
+                    slot.iov.iov_len = size_t(slot.requested - slot.length);
+
+                    // Only this thread writes into the submission queue, so the tail can be read without synchronization
+                    unsigned tail = *sqTail;
+                    unsigned entry = tail & *sqMask;
+
+                    io_uring_sqe* sqe = &sqes[entry];
+                    memset(sqe, 0, sizeof(*sqe));
+                    sqe->opcode = IORING_OP_READV;
+                    sqe->fd = fd;
+                    sqe->addr = uint64_t(uintptr_t(&slot.iov));
+                    sqe->len = 1;
+                    sqe->off = uint64_t(slot.offset + slot.length);
+                    sqe->user_data = uint64_t(index);
+
+                    sqArray[entry] = entry;
+                    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+                    slot.inFlight = true;
+                    inFlight++;
+                    pendingSubmit++;
+                }
+
+                bool enter(unsigned min_complete, unsigned flags)
+                {
+                    while (true) {
+                        long submitted = syscall(__NR_io_uring_enter, ringFd, pendingSubmit, min_complete, flags, nullptr, 0);
+                        if (submitted >= 0) {
+                            pendingSubmit -= unsigned(submitted);
+                            return true;
+                        }
+
+                        if (errno != EINTR)
+                            return false;
+                    }
+                }
+
+                // Waits until at least one read is completed
+                bool waitForCompletion()
+                {
+                    if (enter(1, IORING_ENTER_GETEVENTS) == false)
+                        return false;
+
+                    unsigned cq_head = *cqHead;
+                    while (cq_head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                        const io_uring_cqe& cqe = cqes[cq_head & *cqMask];
+                        size_t index = size_t(cqe.user_data);
+                        Slot& slot = slots[index];
+                        slot.inFlight = false;
+                        inFlight--;
+
+                        if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+                            pushRead(index);
+                        }
+                        else if (cqe.res < 0) {
+                            slot.error = cqe.res;
+                        }
+                        else if (cqe.res == 0) {
+                            // File was truncated
+                            slot.requested = slot.length;
+                        }
+                        else {
+                            // Short reads are continued, so that slots never have gaps
+                            slot.length += cqe.res;
+                            if (slot.length < slot.requested)
+                                pushRead(index);
+                        }
+
+                        cq_head++;
+                    }
+                    __atomic_store_n(cqHead, cq_head, __ATOMIC_RELEASE);
+
+                    return pendingSubmit == 0 || enter(0, 0);
+                }
+
+                // Frees the first slot, once kernel isn't writing into it anymore
+                bool recycleHead()
+                {
+                    while (slots[head].inFlight) {
+                        if (waitForCompletion() == false)
+                            return false;
+                    }
+
+                    head = (head + 1) % slots.size();
+                    queued--;
+
+                    return true;
+                }
+            };
+#endif // OLC_MEDIA_IO_URING
+
+            // Reads from a block of memory, that was given by the user
+            class MemoryBackend : public Backend {
+            public:
+                MemoryBackend(const MediaSource& source) :
+                    data(source.data),
+                    dataSize(int64_t(source.size)),
+                    ownedData(source.owned_data)
+                {
+                }
+
+                int64_t read(uint8_t* buffer, int64_t size) override
+                {
+                    int64_t len = std::min(size, dataSize - position);
+                    if (len <= 0)
+                        return 0;
+
+                    memcpy(buffer, data + position, size_t(len));
+                    position += len;
+
+                    return len;
+                }
+
+                int64_t seek(int64_t offset, int whence) override
+                {
+                    int64_t new_position;
+                    switch (whence) {
+                    case SEEK_SET: new_position = offset; break;
+                    case SEEK_CUR: new_position = position + offset; break;
+                    case SEEK_END: new_position = dataSize + offset; break;
+                    default: return -1;
+                    }
+
+                    if (new_position < 0)
+                        return -1;
+
+                    position = new_position;
+                    return position;
+                }
+
+                int64_t size() override
+                {
+                    return dataSize;
+                }
+
+            private:
+                const uint8_t* data;
+                int64_t dataSize;
+                int64_t position = 0;
+                std::shared_ptr<const std::vector<char>> ownedData;
+            };
+
+            // Reads from a source implemented by the user, and lets it know which data will be read next
+            class CustomBackend : public Backend {
+            public:
+                CustomBackend(std::shared_ptr<IOSource> io_source, int64_t prefetch_size) :
+                    source(std::move(io_source)),
+                    prefetchSize(prefetch_size)
+                {
+                }
+
+                int64_t read(uint8_t* buffer, int64_t size) override
+                {
+                    prefetch();
+
+                    int64_t len = source->Read(buffer, size);
+                    if (len > 0)
+                        position += len;
+
+                    return len;
+                }
+
+                int64_t seek(int64_t offset, int whence) override
+                {
+                    int64_t new_position = source->Seek(offset, whence);
+                    if (new_position < 0)
+                        return new_position;
+
+                    // Prefetching continues from the new position, unless it was already requested
+                    if (new_position < position || new_position > prefetchedEnd)
+                        prefetchedEnd = new_position;
+
+                    position = new_position;
+                    return position;
+                }
+
+                int64_t size() override
+                {
+                    return source->Size();
+                }
+
+            private:
+                std::shared_ptr<IOSource> source;
+                int64_t prefetchSize;
+                int64_t position = 0;
+                int64_t prefetchedEnd = 0; // End of the range source was last asked to prefetch
+
+                // Asks to prefetch the next part of the data, once half of the previously requested part was read
+                void prefetch()
+                {
+                    if (prefetchSize <= 0 || position + prefetchSize / 2 < prefetchedEnd)
+                        return;
+
+                    int64_t begin = std::max(position, prefetchedEnd);
+                    int64_t end = position + prefetchSize;
+                    source->Prefetch(begin, end - begin);
+                    prefetchedEnd = end;
+                }
+            };
+
+        public:
+            IOContext() = default;
+
+            ~IOContext()
+            {
+                closeIO();
+            }
+
+            // Returns true on success
+            bool initAVFmtCtx(const MediaSource& source, AVFormatContext* fmtCtx, const Settings& settings)
+            {
+                closeIO();
+
+                interrupted = false;
+                live = settings.live_input;
+                prefetchSize = live ? 0 : settings.io_readahead_size;
+                uringReads = settings.io_uring_reads;
+                backend = openBackend(source, live ? FileIOType::Buffered : settings.file_io);
+                if (!backend)
+                    return false;
+
+                if (live && isInMemory == false)
+                    backend.reset(new TailFollowBackend(std::move(backend), settings.live_read_timeout, interrupted));
+
+                bufferSize = settings.io_buffer_size;
+
+                // FFMPEG might replace the buffer with a bigger one, so it's freed through "ioCtx"
+                uint8_t* buffer = static_cast<uint8_t*>(av_malloc(bufferSize));
+                if (!buffer)
+                    return false;
+
+                ioCtx = avio_alloc_context(
+                    buffer,         // Internal buffer
+                    (int)bufferSize,     // Buffer size
+                    0,              // Write flag(1=true, 0=false) 
+                    this,           // User data, will be passed to the callback functions
+                    ioread,         // Read callback
+                    nullptr,        // No write callback
+                    live ? nullptr : ioseek); // Seek callback, live input can't be seeked
+
+                if (!ioCtx) {
+                    av_freep(&buffer);
+                    return false;
+                }
+
+                fmtCtx->pb = ioCtx;
+                fmtCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+                // Live input can't be rewound, so "avformat_open_input" probes the format from data buffered by "ioCtx"
+                if (live)
+                    return true;
+
+                // Read the file and let ffmpeg guess it.
+                int64_t len = backend->read(buffer, (int64_t)bufferSize);
+                if (len <= 0)
+                    return false;
+
+                // Seek to the beginning.
+                backend->seek(0, SEEK_SET);
+
+                // Memory mapped files are loaded ahead by the kernel, io_uring already reads ahead,
+                // and memory doesn't have to be loaded at all
+                if (settings.io_readahead_size > 0 && isInMemory == false && isReadAhead == false)
+                    backend.reset(new ReadaheadBackend(std::move(backend), settings.io_readahead_size));
+
+                // Set up a probe.
+                AVProbeData probeData;
+                probeData.buf = buffer;
+                probeData.buf_size = (int)len;
+                probeData.filename = "";
+                probeData.mime_type = NULL;
+
+                fmtCtx->iformat = av_probe_input_format(&probeData, 1);
+
+                return true;
+            }
+
+            // Stops waiting for more live data, so that the demuxer can be stopped
+            void interrupt()
+            {
+                interrupted = true;
+            }
+
+            void closeIO()
+            {
+                if (ioCtx) {
+                    av_freep(&ioCtx->buffer);
+                    avio_context_free(&ioCtx);
+                }
+
+                backend.reset();
+                openedFile.reset();
+            }
+
+            // Returns size of the opened source, or negative value if it's unknown
+            int64_t size()
+            {
+                return backend ? backend->size() : -1;
+            }
+
+            // Returns the file that is read with the buffered backend, or nullptr if a different backend is used
+            std::shared_ptr<SharedFile> sharedFile() const
+            {
+                return openedFile;
+            }
+
+        protected:
+            static int ioread(void* data, uint8_t* buf, int bufSize)
+            {
+                IOContext* thisio = reinterpret_cast<IOContext*>(data);
+                int64_t len = thisio->backend->read(buf, bufSize);
+                if (len < 0)
+                    return AVERROR(EIO);
+                if (len == 0)
+                    return AVERROR_EOF;
+                return (int)len;
+            }
+
+            // Whence: SEEK_SET, SEEK_CUR, SEEK_END and AVSEEK_SIZE
+            static int64_t ioseek(void* data, int64_t pos, int whence)
+            {
+                IOContext* thisio = reinterpret_cast<IOContext*>(data);
+
+                // Returns a negative value, if backend doesn't know the size
+                if (whence & AVSEEK_SIZE)
+                    return thisio->backend->size();
+
+                // Flag only tells that seeking can be done by reading, which doesn't matter here
+                whence &= ~AVSEEK_FORCE;
+
+                return thisio->backend->seek(pos, whence);
+            }
+
+        private:
+            // Recommended buffer size for i/o contexts by ffmpeg docs
+            uint64_t bufferSize = 4096;
+            AVIOContext* ioCtx = nullptr;
+            std::unique_ptr<Backend> backend;
+            bool isInMemory = false;
+            bool isReadAhead = false; // Backend reads ahead by itself
+            std::shared_ptr<SharedFile> openedFile;
+            size_t prefetchSize = 0;
+            unsigned uringReads = 0;
+            bool live = false;
+            std::atomic<bool> interrupted = false;
+
+            std::unique_ptr<Backend> openBackend(const MediaSource& source, FileIOType type)
+            {
+                isReadAhead = false;
+                isInMemory = source.data != nullptr;
+                if (isInMemory)
+                    return std::unique_ptr<Backend>(new MemoryBackend(source));
+
+                if (source.io_source)
+                    return std::unique_ptr<Backend>(new CustomBackend(source.io_source, int64_t(prefetchSize)));
+
+                if (source.shared_file) {
+                    openedFile = source.shared_file;
+                    return std::unique_ptr<Backend>(new BufferedBackend(openedFile, live));
+                }
+
+                const FileName& filename = *source.filename;
+
+#ifdef OLC_MEDIA_IO_URING
+                // Files that can't be read with io_uring are read with the buffered backend
+                if (type == FileIOType::IoUring) {
+                    std::unique_ptr<IoUringBackend> ring(new IoUringBackend());
+                    if (ring->open(filename, uringReads)) {
+                        isReadAhead = true;
+                        return ring;
+                    }
+                }
+#endif // OLC_MEDIA_IO_URING
+
+#ifndef _WIN32
+                if (type == FileIOType::Auto || type == FileIOType::MemoryMapped) {
+                    std::unique_ptr<MemoryMappedBackend> mapped(new MemoryMappedBackend());
+                    if (mapped->open(filename)) {
+                        isInMemory = true;
+                        return mapped;
+                    }
+
+                    // Files that can't be mapped are still read with automatic type
+                    if (type == FileIOType::MemoryMapped)
+                        return nullptr;
+                }
+#else
+                if (type == FileIOType::MemoryMapped)
+                    return nullptr;
+#endif // _WIN32
+
+                std::shared_ptr<SharedFile> file = std::make_shared<SharedFile>();
+                if (file->open(filename) == false)
+                    return nullptr;
+
+                openedFile = file;
+                return std::unique_ptr<Backend>(new BufferedBackend(file, live));
+            }
+        };
+
+    private:
+        // -- Private internal state --
+        AVFormatContext* av_format_ctx = nullptr;
+        IOContext ioCtx;
+
+        Settings settings;
+
+        bool is_paused;
+
+        // When true, the pipeline threads keep on working
+        // When set to false, and pipeline threads are woken up, they are halted
+        std::atomic<bool> keep_loading = true;
+
+        // Decoding is split into 3 threads: demuxer thread reads packets into per stream packet queues,
+        // while video and audio decoder threads decode them into "video_fifo" and "audio_fifo".
+        // Additionally, video converter thread converts frames from "video_fifo" to RGBA into "converted_video_fifo".
+        // If "Settings::executor" is set, these stages run as tasks of the executor instead.
+        // The threads live until the media is closed: reaching the end of the stream only parks them, and seeking
+        // is done by the demuxer thread.
+        std::thread demuxer_thread;
+        std::thread video_decoder_thread;
+        std::thread video_converter_thread;
+        std::thread audio_decoder_thread;
+        // Stages that were submitted to the shared executor
+        std::vector<PipelineStage> executor_stages;
+
+        // Guards waiting on pipeline signals
+        std::mutex mutex;
+        PipelineSignal demuxer_signal;
+        PipelineSignal video_decoder_signal;
+        PipelineSignal video_converter_signal;
+        // Audio playback callback wakes audio decoder without locking
+        PipelineSignal audio_decoder_signal{ std::chrono::milliseconds(10) };
+
+        AVPacket* av_demuxer_packet = nullptr;
+        bool demuxer_reached_end = false; // True when demuxer read the last packet (only used by demuxer thread)
+
+        // Every successful seek increments the serial. Packets, frames and samples are tagged with the serial
+        // they were produced for, so that frames of the position before the latest seek are dropped.
+        std::atomic<int> seek_serial = 0;
+        std::mutex seek_mutex; // Guards the seek requests below
+        bool accepting_seeks = false; // False while pipeline isn't running
+        bool seek_requested = false; // True if demuxer has to seek to "requested_seek_time"
+        double requested_seek_time = 0.0;
+        std::chrono::steady_clock::time_point requested_seek_start; // When the latest seek was requested
+        std::vector<std::promise<Result>> requested_seeks; // Waiting for demuxer to do the seek
+        std::vector<std::promise<Result>> active_seeks;    // Waiting for decoders to reach the target of "active_seek_serial"
+        int active_seek_serial = 0;
+        int active_seek_stages = 0; // Amount of decoders that didn't reach the target of "active_seek_serial" yet
+        std::chrono::steady_clock::time_point active_seek_start;
+        std::atomic<bool> seeking = false; // True while any seek is requested or active
+        std::atomic<double> last_seek_latency = -1.0; // In seconds
+
+        // Index is built by a separate thread, that reads the file with its own format context.
+        // "stream_indices" is only written by index thread (or "StartIndexing()") before "index_ready" is set.
+        std::thread index_thread;
+        std::atomic<bool> keep_indexing = true;
+        std::atomic<bool> index_ready = false;
+        AVFormatContext* index_format_ctx = nullptr;
+        IOContext index_io_ctx;
+        std::vector<StreamIndex> stream_indices; // Only opened streams are indexed
+        // Copied from "av_format_ctx" before index thread starts, because demuxer thread can add streams
+        // (formats without a header, like MPEG-TS) and update their parameters while index is built
+        std::vector<IndexedStreamInfo> index_streams;
+        int64_t index_duration = AV_NOPTS_VALUE;
+        int index_video_stream = -1;
+        // False if demuxer doesn't know where keyframes are, until keyframes of the index are added to it.
+        // Set before demuxer thread starts, and then only used by it.
+        bool demuxer_has_index = true;
+        // Index cache layout (native byte order):
+        // magic, uint32 version, int64 source size, int64 source modification time, int64 duration, uint32 stream count, and for every stream:
+        // int32 codec id, int32 time base num, int32 time base den, uint64 packet count, and for every packet:
+        // int64 pts, int64 dts, int64 pos, uint8 keyframe
+        static constexpr char index_cache_magic[8] = "OLCIDX1";
+        static constexpr uint32_t index_cache_version = 2;
+        // Identify the source the index was built from. Modification time is only known for files.
+        int64_t index_source_size = -1;
+        int64_t index_source_mtime = 0;
+
+        // Demuxer keeps on reading until every opened stream has this many packets queued
+        static constexpr size_t min_queued_packets = 25;
+        // Demuxer stops reading when this many bytes are queued in total, even if some stream needs more packets
+        static constexpr size_t max_queued_packet_bytes = 64 * 1024 * 1024;
+
+        
+        // -- Video stuff --
+        int video_stream_index = -1;
+        AVRational video_time_base;
+        PacketQueue video_packets;
+        VideoQueue video_fifo;
+        AVPacket* av_video_packet = nullptr; // Packet currently being sent to video decoder
+        bool video_decoder_draining = false; // True when all packets were sent to video decoder
+        std::atomic<bool> video_decoder_finished = false; // True when video decoder won't push any more frames to "video_fifo"
+        int video_decoder_serial = 0; // Seek serial of packets that video decoder currently decodes
+        double video_seek_target = -1.0; // Frames before this timepoint aren't pushed. Negative when video decoder isn't seeking.
+        bool video_preroll_quality = false; // True while decoder skips work that isn't needed to reach the seek target
+        bool video_keyframes_only = false; // True while decoder drops all packets except keyframes
+        bool video_supports_lowres = false;
+        // Quality requested by "GetVideoFrame(delta_time)" and applied by video decoder
+        std::atomic<VideoDecodeQuality> video_decode_quality = VideoDecodeQuality::Full;
+        // Catch-up controller state (only used by the thread that calls "GetVideoFrame(delta_time)").
+        // Quality is lowered when video stays late for "video_quality_lower_delay", and raised when it stays on time for
+        // "video_quality_raise_delay". Different delays and thresholds keep quality from flipping back and forth.
+        int video_lateness_state = 0; // 1 - late, -1 - on time, 0 - in between
+        std::chrono::steady_clock::time_point video_lateness_state_start;
+        std::chrono::steady_clock::time_point video_quality_change_time;
+        static constexpr double video_late_frames = 4.0;    // Video is late when it's behind by this many frames
+        static constexpr double video_on_time_frames = 1.0; // Video is on time when it's behind by less than this many frames
+        static constexpr std::chrono::milliseconds video_quality_lower_delay{ 500 };
+        static constexpr std::chrono::milliseconds video_quality_raise_delay{ 3000 };
+        // Packets this close to the seek target are decoded at full quality, as their frames might be displayed,
+        // or be referenced by the displayed ones
+        static constexpr double video_full_quality_seek_window = 0.5;
+        ConvertedFrameQueue converted_video_fifo;
+        // Amount of frames converter thread can prepare ahead of time
+        static constexpr size_t converted_video_queue_capacity = 3;
+        // Frames with earlier timestamp than this are dropped by the converter, as "GetVideoFrame(delta_time)" would skip them anyway.
+        // Negative when unknown.
+        std::atomic<double> video_presentation_time = -1.0;
+        // Seek serial of the frames that "GetVideoFrame(delta_time)" currently displays
+        std::atomic<int> displayed_video_serial = 0;
+        const AVCodec* av_video_codec = nullptr;
+        AVCodecContext* av_video_codec_ctx = nullptr;
+        SwsContext* sws_video_scaler_ctx = nullptr;
+        BandWorkers video_converter_workers;
+        // Contexts of every band, when frame is converted by several threads with swscale
+        std::vector<SwsContext*> sws_video_band_ctxs;
+        // Bands of frames with vertically subsampled chroma are converted into these with extra rows around them
+        std::vector<std::vector<olc::Pixel>> video_band_buffers;
+        // Extra rows converted above and below a band. Covers the chroma rows read by vertical filters of every scaler.
+        static constexpr int band_overlap_rows = 16;
+        // Used by converter thread to temporary store converted video frame, when target rows aren't aligned for swscale.
+        // Only allocated when it's needed.
+        AVFrame* temp_video_frame = nullptr;
+        std::vector<olc::Renderable> video_frames; // Ring of frames returned by "GetVideoFrame" functions
+        size_t current_video_frame = 0; // Index of the frame in "video_frames" that was returned last
+        size_t video_frame_bytes = 0; // Approximate size of a single decoded frame
+        int video_width = 0;  // Output width (after scaling)
+        int video_height = 0; // Output height (after scaling)
+        int video_scaler_flags = SWS_BILINEAR;
+        int video_delay = 0;
+        float delta_time_accumulator = 0.0f;
+        double last_video_pts = 0.0;
+        bool video_opened = false;
+        bool attached_pic = false; // True if video stream is a single attached picture (for example album art in mp3 metadata)
+
+        // -- Audio stuff --
+        int audio_stream_index = -1;
+        AVRational audio_time_base;
+        PacketQueue audio_packets;
+        AudioQueue audio_fifo;
+        AVPacket* av_audio_packet = nullptr; // Packet currently being sent to audio decoder
+        AVFrame* av_audio_frame = nullptr; // Decoded audio frame
+        AVFrame* resampled_audio_frame = nullptr; // Used to store converted "av_audio_frame"
+        bool audio_decoder_draining = false; // True when all packets were sent to audio decoder
+        std::atomic<bool> audio_decoder_finished = false; // True when audio decoder won't push any more samples to "audio_fifo"
+        int audio_decoder_serial = 0; // Seek serial of packets that audio decoder currently decodes
+        double audio_seek_target = -1.0; // Frames before this timepoint aren't pushed. Negative when audio decoder isn't seeking.
+        // Packets ending earlier than this before the seek target aren't decoded at all.
+        // Some codecs need a few previous packets to decode the next one correctly.
+        double audio_seek_preroll = 0.0;
+        static constexpr double min_audio_seek_preroll = 0.1;
+        int pending_audio_samples = 0; // Samples in "resampled_audio_frame" that didn't fit into "audio_fifo" yet
+        int pending_audio_offset = 0;  // First sample in "resampled_audio_frame" that wasn't pushed yet
+        const AVCodec* av_audio_codec = nullptr;
+        AVCodecContext* av_audio_codec_ctx = nullptr;
+        SwrContext* swr_audio_resampler = nullptr;
+        AVSampleFormat audio_format;
+        int audio_sample_size = 0;
+        int audio_sample_rate = 0;
+        int audio_channel_count = 0;
+        // Default volume is 1 (max) for miniaud.io, so it's better to have video playing quieter than louder
+        float audio_volume = 0.5f;
+        bool audio_opened = false;
+
+#ifndef OLC_MEDIA_CUSTOM_AUDIO_PLAYBACK
+        ma_device audio_device;
+#endif //OLC_MEDIA_CUSTOM_AUDIO_PLAYBACK
+
+	public:
+        Media();
+        ~Media();
+
+        // -- Video and audio functions --
+
+        // If media is already open, closes it first.
+        // - preloaded_frames_scale: Affects how many seconds of pre-decoded video/audio frames should be stored. (only suggested to 
+        //   increase it, when you notice that some of your video/audio frames are skipped).
+        // - settings: Playback settings. Pass nullptr to use default settings.
+        // NOTE: You shouldn't use this class to load static image formats as they most likely won't work (such as ".jpg" or ".png")
+        Result Open(const std::string& filename, bool open_video, bool open_audio, Settings* settings);
+
+#ifdef _WIN32
+        // Windows exclusive function, because windows allows filenames to have unicode characters.
+        Result Open(const std::wstring& filename, bool open_video, bool open_audio, Settings* settings);
+#endif // _WIN32
+
+        // Opens media that is already loaded into memory. Memory isn't copied, so it must stay valid
+        // until "Close()" is called, or other media is opened.
+        Result Open(const uint8_t* data, size_t size, bool open_video, bool open_audio, Settings* settings);
+
+        // Opens media from a custom source (see "IOSource"). Source is owned by the media until it's closed.
+        Result Open(std::unique_ptr<IOSource> source, bool open_video, bool open_audio, Settings* settings);
+
+        // Opens a file that is stored in the resource pack. File data is taken out of the pack once, so the pack
+        // doesn't have to outlive the media.
+        Result Open(olc::ResourcePack& pack, const std::string& filename, bool open_video, bool open_audio, Settings* settings);
+
+        // If media is currently open, closes it and frees up all the resources.
+        void Close();
+
+        // Returns true if any of the following is true:
+        // - Media file wasn't opened;
+        // - No more frames are available in the media file;
+        // - Error occured when trying to receive a packet.
+        bool FinishedReading();
+
+        // If media was playing, pauses it.
+        // Does nothing if media isn't open.
+        void Pause();
+
+        // If media was paused, continues playing it.
+        // Does nothing if media isn't open.
+        void Play();
+
+        // Returns true if media is currently paused.
+        bool IsPaused();
+
+        // Returns bytes currently held by decoded video frames that are waiting to be converted,
+        // and by converted video frames. Returns 0 if video isn't open.
+        size_t GetVideoQueueBytes();
+
+        // Returns bytes held by decoded audio samples buffer. Returns 0 if audio isn't open.
+        size_t GetAudioQueueBytes();
+
+        // Seeks the media file to specified timepoint and resumes playback.
+        // Blocks until frames at the new position are decoded.
+        // - new_time: wanted timestamp in seconds
+        Result Seek(double new_time);
+
+        // Starts seeking the media file to specified timepoint and returns right away.
+        // Seek is done by decoding threads, so the old position keeps on playing until the frames at the new position are decoded.
+        // If it's called again before the previous seek is done, only the latest timepoint is decoded, and earlier
+        // seeks complete together with it.
+        // - new_time: wanted timestamp in seconds
+        // Returned future becomes ready once the frames at the new position are decoded, or seeking failed.
+        std::future<Result> SeekAsync(double new_time);
+
+        // Returns seconds it took from requesting the latest completed seek, until the frames at its position were decoded.
+        // Returns negative value if no seek has completed yet.
+        double GetLastSeekLatency();
+
+        // Returns true once the index of media packets was built or loaded (see "Settings::build_index").
+        bool IsIndexReady();
+
+        // Returns amount of video packets that would have to be decoded to seek to specified timepoint.
+        // Returns -1 if it's unknown (video isn't open or index isn't ready yet).
+        int64_t EstimateSeekCost(double new_time);
+
+        // Returns current position in media that is being played.
+        // If media isn't open, returns 0.0
+        double GetCurrentPlaybackTime();
+
+
+        // -- Video functions --
+        
+        // Returns next video frame, unless media is paused.
+        // When only video is playing, delta_time is used to synchronise the video.
+        // If video is played together with audio, delta_time is ignored, and video is synchronised based on
+        // how many audio frames were consumed.
+        // If media was paused before a single video frame could be decoded, the returned frame might be empty.
+        // 
+        // NOTE: Returned decal's pixel data stays the same until "Settings::video_output_frames" new frames were returned.
+        olc::Decal* GetVideoFrame(float delta_time);
+
+        // Returns next video frame even when media is paused.
+        // 
+        // NOTE: Returned decal's pixel data stays the same until "Settings::video_output_frames" new frames were returned.
+        // NOTE: Only use this function, if you want to implement video synchronisation yourself.
+        olc::Decal* GetVideoFrame();
+
+        // Pops video frame from the internal queue.
+        // If one of the following is true, function does nothing and returns Error enum:
+        // - Video wasn't opened;
+        // - No more frames are avialable in the video;
+        // - Decoder didn't decode a frame yet.
+        // 
+        // NOTE: Only use this function, if you want to implement video synchronisation yourself.
+        Result SkipVideoFrame();
+
+        // Returns true if video was sucessfully opened with "Open()" function and "Close()" wasn't called.
+        bool IsVideoOpened();
+
+        // Not all videos have frames of equal length, so FPS can only be average.
+        double GetAverageVideoFPS();
+
+        // Returns size of frames returned by "GetVideoFrame" functions (see "Settings::video_output_width").
+        // Returns 0 if video isn't opened.
+        int GetVideoWidth();
+        int GetVideoHeight();
+
+        // Returns amount of frames in the video. Until index is ready, returns amount stored in the media
+        // metadata, which might be inaccurate, or 0 if it's missing.
+        int64_t GetFrameCount();
+
+        // Seeks to the frame with specified number (starting from 0, in presentation order) and resumes playback.
+        // Blocks until the frame is decoded. Returns Error if index isn't ready yet or frame doesn't exist.
+        Result SeekToFrame(int64_t frame);
+
+        // Returns quality video is currently decoded at (see "Settings::adaptive_video_quality").
+        VideoDecodeQuality GetVideoDecodeQuality();
+
+        // Prints video info to console.
+        // 
+        // NOTE: The printed information can change between versions.
+        void PrintVideoInfo();
+
+        
+		//bool seek_frame(int64_t ts);
+		
+
+        // -- Audio functions --
+        // Returns amount of samples that were read (if not all samples were written, the rest will be filled with 0s (silence))
+        // or -1 if an error occured due to bad parameters or other reasons.
+        // output: pointer to byte array pointed by "void*", where the byte array size must be "channel_count * sample_count * sample_size".
+        // This function never blocks, so it's safe to call it from real-time audio thread.
+        // 
+        // NOTE: Only use this function if you intend to play the audio yourself. If you do decide to handle audio yourself,
+        // note, that when video and audio is played together, video is synchronised according to how many audio samples have been read.
+        int GetAudioFrame(void** output, int sample_count);
+
+        // Returns true if audio was sucessfully opened with "Open()" function and "Close()" wasn't called.
+        bool IsAudioOpened();
+
+        // Prints audio info to console.
+        // 
+        // NOTE: The printed information can change between versions.
+        void PrintAudioInfo();
+
+        // If audio isn't opened, does nothing.
+        // new_volume: value between 0 (silence) and 1 (full volume). The value is clamped if it exceeds bounds.
+        //
+        // NOTE: This doesn't affect audio output frame volume when using your own audio backend.
+        void SetAudioVolume(float new_volume);
+
+        // Returns value between 0 (silence) and 1 (full volume). The value is clamped if it exceeds bounds.
+        // If audio isn't open, returns 0.
+        //
+        // NOTE: This doesn't affect audio output frame volume when using your own audio backend.
+        float GetAudioVolume();
+
+        // Returns audio format that will be converted (if needed) and stored when reading audio data, that 
+        // you can expect to get from "GetAudioFrame()" function.
+        // If audio isn't open, returns AV_SAMPLE_FMT_NONE.
+        AVSampleFormat GetAudioOutputFormat();
+
+        // Returns original audio format that was stored in the media.
+        // If audio isn't open, returns AV_SAMPLE_FMT_NONE.
+        AVSampleFormat GetAudioOriginalFormat();
+
+        // Returns 
         int GetAudioSampleSize();
 
-        int GetAudioSampleRate();
+        int GetAudioSampleRate();
+
+        int GetAudioChannelCount();
+
+        // Returns true if audio format has attached album art (for example album art in .mp3 metadata section)
+        bool HasAlbumArt();
+
+
+    private:
+        // -- Video and audio functions --
+        Result Open(const MediaSource& source, bool open_video, bool open_audio, Settings* settings);
+        Result OpenFile(const MediaSource& source);
+        void CloseFile();
+        // Makes demuxer skip packets of all the streams that aren't decoded, instead of reading them only to be thrown away
+        void DiscardUnusedStreams();
+        // Starts demuxer and decoder threads
+        void StartDecodingThread();
+        // Stops and joins demuxer and decoder threads
+        void StopDecodingThread();
+        // Starts "stage" on its own thread, or submits it to the shared executor
+        void StartPipelineStage(PipelineStage stage, std::thread& thread);
+        void PipelineThread(PipelineStage stage);
+        // Repeats the step of "stage" until it finishes, or pipeline is stopped. Sleeps on its signal whenever the step is blocked.
+        void RunPipelineStage(PipelineStage stage);
+        StepResult RunPipelineStep(PipelineStage stage);
+        // Called once the stage won't do any more steps (pipeline was stopped or error occured)
+        void FinishPipelineStage(PipelineStage stage);
+        PipelineSignal& GetPipelineSignal(PipelineStage stage);
+        // Seconds of decoded output the stage has ready, before playback runs out of it
+        double GetPipelineBufferedTime(PipelineStage stage);
+        void WakePipelineStage(PipelineSignal& signal);
+        // Same as "WakePipelineStage()", but never blocks. The wake up might be missed, so "signal" must have "poll_interval" set.
+        void WakePipelineStageFromRealtimeThread(PipelineSignal& signal);
+        // Reads a single packet into the packet queue of its stream
+        StepResult DemuxStep();
+        // Seeks to the latest requested timepoint and flushes packet queues.
+        // Returns false if no seek was requested.
+        bool ProcessSeekRequest();
+        // Called by a decoder once it reached the target of seek with "serial", or the end of the stream
+        void CompleteSeekStage(int serial);
+        // Completes all the active seeks successfully. Must be called with "seek_mutex" locked.
+        void ResolveActiveSeeks();
+        // Completes all the requested and active seeks with an error, and stops accepting new ones
+        void FailSeeks();
+        // Must be called with "seek_mutex" locked
+        void UpdateSeekingState();
+        // Takes the index from the container, or opens the file for index thread and starts it.
+        // Must be called before the demuxer thread starts.
+        void StartIndexing(const MediaSource& source);
+        void StopIndexing();
+        void IndexThread();
+        Result BuildIndex();
+        // Returns true if demuxer knows the position of every video packet
+        bool LoadContainerIndex();
+        // Lets demuxer seek straight to the keyframes of the index
+        void AddDemuxerIndexEntries(const StreamIndex& index);
+        Result LoadIndexCache();
+        Result SaveIndexCache();
+        template<typename T>
+        static bool WriteIndexValue(FILE* file, const T& value);
+        template<typename T>
+        static bool ReadIndexValue(FILE* file, T& value);
+        bool IsIndexedStream(int stream_index);
+        // Fills "keyframes" and "frame_pts" from "packets"
+        static void FinishStreamIndex(StreamIndex& index);
+        // Returns nullptr if video index isn't available
+        const StreamIndex* GetVideoIndex();
+        // Returns index of the last keyframe in "index.packets" that is displayed not later than "time"
+        size_t FindSeekKeyframe(const StreamIndex& index, double time);
+        double VideoTimestampToSeconds(int64_t timestamp);
+        // Returns true if demuxer shouldn't read more packets for now
+        bool HasEnoughQueuedPackets();
+        static void RaiseThreadPriority(std::thread& thread);
+        static const char* GetError(int errnum);
+        // Returns success, if all settings are valid
+        Result ApplySettings();
+        
+
+        // -- Video functions --
+        Result InitVideo();
+        void CloseVideo();
+        void ConvertFrameToRGBA(AVFrame* frame, olc::Pixel* target);
+        // Calls "convert_rows(row_begin, row_end)" for bands of rows in parallel
+        void ConvertRowsInBands(int rows, const std::function<void(int, int)>& convert_rows);
+        // Converts a frame with swscale, splitting it into bands that are converted in parallel.
+        // Returns false if frame can't be split (frames that are scaled, paletted formats, etc.).
+        bool ConvertFrameInBands(AVFrame* frame, olc::Pixel* target);
+        void FreeBandScalers();
+        // Converts a single frame from "video_fifo" into "converted_video_fifo"
+        StepResult ConvertVideoStep();
+        // Send updated pixel data in olc::Sprite to GPU
+        void UpdateResultSprite();
+        // Returns decal of the frame that was returned last, or nullptr if video was never opened
+        olc::Decal* GetCurrentVideoDecal();
+        // Calculates video pts in seconds
+        double CalculateVideoPts(const AVFrame* frame);
+        // Receives a single decoded frame into "video_fifo", or sends the next packet to the decoder
+        StepResult DecodeVideoStep();
+        // Drops decoder state of the old position, after demuxer started new serial
+        void FlushVideoDecoder(int serial, double seek_target);
+        // Makes decoder skip non reference frames and loop filtering, while seek target is still far away.
+        // Must be called before the packet is sent to decoder.
+        void UpdateVideoPrerollQuality(const AVPacket* packet);
+        void SetVideoPrerollQuality(bool enabled);
+        // Applies quality requested by catch-up controller. Must be called before the packet is sent to decoder.
+        Result UpdateVideoDecodeQuality(const AVPacket* packet);
+        // Sets skip hints of the decoder according to seek preroll and current quality
+        void ApplyVideoSkipHints();
+        // Creates and opens video codec context, replacing the old one if it exists
+        Result OpenVideoDecoder(int lowres);
+        // Lowers or raises decoding quality according to how late the video is.
+        // - lateness: how many seconds the oldest available frame is behind playback time
+        void AdaptVideoDecodeQuality(double lateness);
+        double GetVideoFrameDuration();
+        // Returns true if frame with "serial" was decoded before the latest seek
+        bool IsStaleVideoFrame(int serial);
+        Result HandleVideoDelay();
+        // Returns the next converted frame, dropping the frames of the position before the latest seek
+        const ConvertedFrame* PeekFrame();
+        static AVPixelFormat CorrectDeprecatedPixelFormat(AVPixelFormat pix_fmt);
+        // Sets up "thread_count" and "thread_type" of video codec context according to settings.
+        // Must be called before the codec context is opened.
+        void SetupVideoDecoderThreading();
+        // Amount of decoded frames "video_fifo" can store, according to preroll and memory budget settings
+        size_t CalculateVideoQueueCapacity();
+        // Calculates "video_width" and "video_height" from source size and output size settings
+        void CalculateVideoOutputSize(int source_width, int source_height);
+        static int GetScalerFlags(VideoScaler scaler);
+
+        // -- Audio functions --
+        Result InitAudio();
+        void CloseAudio();
+        // Calculates audio pts in seconds
+        double CalculateAudioPts(const AVFrame* frame);
+        // Receives a single decoded frame into "audio_fifo", or sends the next packet to the decoder
+        StepResult DecodeAudioStep();
+        // Drops decoder state of the old position, after demuxer started new serial
+        void FlushAudioDecoder(int serial, double seek_target);
+        // Returns true if packet ends so much earlier than seek target, that it doesn't have to be decoded
+        bool IsAudioPacketBeforeSeekTarget(const AVPacket* packet);
+        // Timestamp of the next audio sample that will be played
+        double GetAudioTime();
+        // Resamples "input" into "resampled_audio_frame", that becomes pending to be pushed into "audio_fifo".
+        // Pass nullptr to get remaining samples delayed inside the resampler.
+        Result ResampleAudioFrame(const AVFrame* input);
+        // Pushes pending samples into "audio_fifo". Returns true if all of them fit.
+        bool PushPendingAudioSamples();
+        Result ChooseAudioFormat();
+        Result InitialiseAndStartMiniaudio();
+	};
+}
+
+// Definitions
+namespace olc {
+    MediaExecutor::MediaExecutor(unsigned int thread_count) {
+        if (thread_count == 0)
+            thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+        for (unsigned int i = 0; i < thread_count; ++i)
+            workers.push_back(std::make_unique<Worker>());
+
+        // Threads are started only once all workers exist, as they steal from each other
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i]->thread = std::thread(&MediaExecutor::WorkerThread, this, i);
+    }
+
+    MediaExecutor::~MediaExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_available.notify_all();
+
+        for (std::unique_ptr<Worker>& worker : workers)
+            worker->thread.join();
+    }
+
+    void MediaExecutor::Submit(Task* task) {
+        task->state = Task::State::Queued;
+        task->wake_requested = false;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(task);
+        }
+
+        Enqueue(task);
+    }
+
+    void MediaExecutor::Wake(Task* task) {
+        Task::State state = task->state;
+
+        while (true) {
+            if (state == Task::State::Parked) {
+                if (task->state.compare_exchange_weak(state, Task::State::Queued)) {
+                    Enqueue(task);
+                    return;
+                }
+            }
+            else if (state == Task::State::Running) {
+                // Worker running the task will queue it again
+                if (task->state.compare_exchange_weak(state, Task::State::RunningWoken))
+                    return;
+            }
+            else {
+                return;
+            }
+        }
+    }
+
+    void MediaExecutor::WakeFromRealtimeThread(Task* task) {
+        // Workers check for these wake ups every "realtime_wake_latency", so notification can be sent without locking
+        task->wake_requested = true;
+        realtime_wakes = true;
+        work_available.notify_one();
+    }
+
+    void MediaExecutor::WaitUntilDone(Task* task) {
+        std::unique_lock<std::mutex> lock(mutex);
+        task_done.wait(lock, [&]() { return task->state == Task::State::Done; });
+    }
+
+    unsigned int MediaExecutor::GetThreadCount() {
+        return (unsigned int)workers.size();
+    }
+
+    void MediaExecutor::WorkerThread(size_t worker_index) {
+        ThisThreadWorker() = { this, worker_index };
+
+        while (true) {
+            if (realtime_wakes.exchange(false))
+                ProcessRealtimeWakes();
+
+            Task* task = Dequeue(worker_index);
+            if (task != nullptr) {
+                Run(task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (stopping)
+                break;
+
+            work_available.wait_for(lock, realtime_wake_latency, [&]() {
+                return stopping || queued_tasks > 0 || realtime_wakes;
+            });
+        }
+    }
+
+    void MediaExecutor::Enqueue(Task* task) {
+        QueuedTask queued_task{ task->Deadline(), task };
+
+        // Tasks queued from worker threads stay on the same worker, others are spread around
+        size_t worker_index = CurrentWorkerIndex();
+        if (worker_index >= workers.size())
+            worker_index = next_worker++ % workers.size();
+
+        Worker& worker = *workers[worker_index];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.queue.push_back(queued_task);
+            std::push_heap(worker.queue.begin(), worker.queue.end(), LaterDeadline);
+        }
+
+        ++queued_tasks;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+        work_available.notify_one();
+    }
+
+    MediaExecutor::Task* MediaExecutor::Dequeue(size_t worker_index) {
+        if (queued_tasks == 0)
+            return nullptr;
+
+        // Find the worker with the most urgent task, starting from own queue
+        size_t best_worker = workers.size();
+        std::chrono::steady_clock::time_point best_deadline;
+
+        for (size_t i = 0; i < workers.size(); ++i) {
+            size_t index = (worker_index + i) % workers.size();
+            Worker& worker = *workers[index];
+
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.queue.empty())
+                continue;
+
+            if (best_worker == workers.size() || worker.queue.front().deadline < best_deadline) {
+                best_worker = index;
+                best_deadline = worker.queue.front().deadline;
+            }
+        }
+
+        if (best_worker == workers.size())
+            return nullptr;
+
+        // Queue might have changed since it was checked, but any task from it is good enough
+        Worker& worker = *workers[best_worker];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.queue.empty())
+            return nullptr;
+
+        std::pop_heap(worker.queue.begin(), worker.queue.end(), LaterDeadline);
+        Task* task = worker.queue.back().task;
+        worker.queue.pop_back();
+        --queued_tasks;
+
+        return task;
+    }
+
+    void MediaExecutor::Run(Task* task) {
+        task->state = Task::State::Running;
+
+        auto start_time = std::chrono::steady_clock::now();
+
+        TaskResult result;
+        do {
+            result = task->Step();
+        } while (result == TaskResult::Continue && std::chrono::steady_clock::now() - start_time < time_slice);
+
+        if (result == TaskResult::Done) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                task->state = Task::State::Done;
+                tasks.erase(std::remove(tasks.begin(), tasks.end(), task), tasks.end());
+            }
+            task_done.notify_all();
+            return;
+        }
+
+        if (result == TaskResult::Park) {
+            Task::State state = Task::State::Running;
+            if (task->state.compare_exchange_strong(state, Task::State::Parked))
+                return;
+
+            // Task was woken up while it was running, so what it was waiting for might have already happened
+        }
+
+        // Queue it again with updated deadline
+        task->state = Task::State::Queued;
+        Enqueue(task);
+    }
+
+    void MediaExecutor::ProcessRealtimeWakes() {
+        std::vector<Task*> woken_tasks;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Task* task : tasks) {
+                if (task->wake_requested.exchange(false))
+                    woken_tasks.push_back(task);
+            }
+        }
+
+        for (Task* task : woken_tasks)
+            Wake(task);
+    }
+
+    size_t MediaExecutor::CurrentWorkerIndex() {
+        const std::pair<const MediaExecutor*, size_t>& worker = ThisThreadWorker();
+        return worker.first == this ? worker.second : workers.size();
+    }
+
+    std::pair<const MediaExecutor*, size_t>& MediaExecutor::ThisThreadWorker() {
+        thread_local std::pair<const MediaExecutor*, size_t> worker{ nullptr, 0 };
+        return worker;
+    }
+
+    bool MediaExecutor::LaterDeadline(const QueuedTask& a, const QueuedTask& b) {
+        return a.deadline > b.deadline;
+    }
+
+    Media::Media() {
+        demuxer_signal.task.stage = PipelineStage::Demuxer;
+        video_decoder_signal.task.stage = PipelineStage::VideoDecoder;
+        video_converter_signal.task.stage = PipelineStage::VideoConverter;
+        audio_decoder_signal.task.stage = PipelineStage::AudioDecoder;
+
+        for (PipelineStage stage : { PipelineStage::Demuxer, PipelineStage::VideoDecoder, PipelineStage::VideoConverter, PipelineStage::AudioDecoder }) {
+            GetPipelineSignal(stage).task.media = this;
+        }
+    }
+
+    Media::~Media() {
+        Close();
+    }
+
+    Media::Result Media::Open(const std::string& filename, bool open_video, bool open_audio, Settings* settings) {
+        FileName name{ filename.c_str() };
+        MediaSource source;
+        source.filename = &name;
+
+        return Open(source, open_video, open_audio, settings);
+    }
+
+#ifdef _WIN32
+    Media::Result Media::Open(const std::wstring& filename, bool open_video, bool open_audio, Settings* settings) {
+        FileName name{ filename.c_str() };
+        MediaSource source;
+        source.filename = &name;
+
+        return Open(source, open_video, open_audio, settings);
+    }
+#endif // _WIN32
+
+    Media::Result Media::Open(const uint8_t* data, size_t size, bool open_video, bool open_audio, Settings* settings) {
+        OLC_MEDIA_ASSERT(data != nullptr && size > 0, "Media data is empty");
+
+        MediaSource source;
+        source.data = data;
+        source.size = size;
+
+        return Open(source, open_video, open_audio, settings);
+    }
+
+    Media::Result Media::Open(std::unique_ptr<IOSource> io_source, bool open_video, bool open_audio, Settings* settings) {
+        OLC_MEDIA_ASSERT(io_source != nullptr, "IO source is null");
+
+        MediaSource source;
+        source.io_source = std::move(io_source);
+
+        return Open(source, open_video, open_audio, settings);
+    }
+
+    Media::Result Media::Open(olc::ResourcePack& pack, const std::string& filename, bool open_video, bool open_audio, Settings* settings) {
+        OLC_MEDIA_ASSERT(pack.Loaded(), "Resource pack isn't loaded");
+
+        // Buffer already holds a copy of the file data, so it's moved out instead of being copied again
+        olc::ResourceBuffer buffer = pack.GetFileBuffer(filename);
+        std::shared_ptr<std::vector<char>> data = std::make_shared<std::vector<char>>(std::move(buffer.vMemory));
+        OLC_MEDIA_ASSERT(data->empty() == false, "Couldn't find file in resource pack");
+
+        MediaSource source;
+        source.data = reinterpret_cast<const uint8_t*>(data->data());
+        source.size = data->size();
+        source.owned_data = data;
+
+        return Open(source, open_video, open_audio, settings);
+    }
+
+    void Media::Close() {
+        // Demuxer might be waiting for more live data
+        ioCtx.interrupt();
+
+        StopDecodingThread();
+        StopIndexing();
+        CloseFile();
+        CloseVideo();
+        CloseAudio();
+    }
+
+    bool Media::FinishedReading() {
+        // If neither of the streams were open, return false
+        if (IsVideoOpened() == false && IsAudioOpened() == false)
+            return false;
+
+        // Decoders might still be in finished state of the position before the seek
+        if (seeking)
+            return false;
+
+        // Check if decoders have finished and all the frames were read from the streams that were open
+        bool video_finished = true;
+        bool audio_finished = true;
+
+        if (IsVideoOpened() && (video_decoder_finished == false || video_fifo.size() > 0 || converted_video_fifo.size() > 0)) {
+            video_finished = false;
+        }
+
+        if (IsAudioOpened() && (audio_decoder_finished == false || audio_fifo.size() > 0)) {
+            audio_finished = false;
+        }
+
+        return video_finished && audio_finished;
+    }
+
+    void Media::Pause() {
+        if ((IsAudioOpened() || IsVideoOpened()) == false)
+            return;
+
+        if (IsPaused())
+            return;
+
+        if (IsAudioOpened())
+            ma_device_stop(&audio_device);
+
+        is_paused = true;
+    }
+    
+    void Media::Play() {
+        if ((IsAudioOpened() || IsVideoOpened()) == false)
+            return;
+
+        if (IsPaused() == false)
+            return;
+
+        if (IsAudioOpened())
+            ma_device_start(&audio_device);
+
+        is_paused = false;
+    }
+
+    bool Media::IsPaused() {
+        return is_paused;
+    }
+
+    size_t Media::GetVideoQueueBytes() {
+        if (IsVideoOpened() == false)
+            return 0;
+
+        // Unreferenced frames of "video_fifo" don't hold any buffers
+        return video_fifo.size() * video_frame_bytes + converted_video_fifo.bytes();
+    }
+
+    size_t Media::GetAudioQueueBytes() {
+        if (IsAudioOpened() == false)
+            return 0;
+
+        return audio_fifo.bytes();
+    }
+
+    Media::Result Media::Seek(double new_time) {
+        Result result = SeekAsync(new_time).get();
+
+        // Continue playing even if seek wasn't successful
+        Play();
+
+        return result;
+    }
+
+    std::future<Media::Result> Media::SeekAsync(double new_time) {
+        std::promise<Result> promise;
+        std::future<Result> future = promise.get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(seek_mutex);
+
+            if (accepting_seeks == false || settings.live_input) {
+                promise.set_value(Result::Error);
+                return future;
+            }
+
+            // If demuxer didn't start previous requested seek yet, it's replaced, so that only the latest timepoint is decoded
+            seek_requested = true;
+            requested_seek_time = new_time;
+            requested_seek_start = std::chrono::steady_clock::now();
+            requested_seeks.push_back(std::move(promise));
+            UpdateSeekingState();
+        }
+
+        WakePipelineStage(demuxer_signal);
+
+        return future;
+    }
+
+    double Media::GetLastSeekLatency() {
+        return last_seek_latency;
+    }
+
+    bool Media::IsIndexReady() {
+        return index_ready;
+    }
+
+    int64_t Media::EstimateSeekCost(double new_time) {
+        const StreamIndex* index = GetVideoIndex();
+        if (index == nullptr)
+            return -1;
+
+        // Everything from the keyframe up to the packet of the target frame has to be decoded
+        int64_t cost = 0;
+        for (size_t i = FindSeekKeyframe(*index, new_time); i < index->packets.size(); ++i) {
+            ++cost;
+
+            const IndexEntry& packet = index->packets[i];
+            if (packet.pts != AV_NOPTS_VALUE && VideoTimestampToSeconds(packet.pts) >= new_time)
+                break;
+        }
+
+        return cost;
+    }
+
+    double Media::GetCurrentPlaybackTime() {
+        double time = 0.0;
+
+        if (IsVideoOpened()) {
+            time = last_video_pts;
+        }
+        else if (IsAudioOpened()) {
+            time = GetAudioTime();
+        }
+
+        return time;
+    }
+
+    olc::Decal* Media::GetVideoFrame(float delta_time) {
+        //printf("video fifo size %llu\n", video_fifo.size());
+
+        if (IsVideoOpened() == false) {
+            printf("Video isn't open\n");
+            return nullptr;
+        }
+
+        if (FinishedReading()) {
+            //printf("Finished reading video\n");
+            return GetVideoFrame();
+        }
+
+        // This returned video frame might be empty
+        if (IsPaused()) {
+            return GetCurrentVideoDecal();
+        }
+
+        if (HasAlbumArt()) {
+            return GetVideoFrame();
+        }
+
+        // First frame after a seek starts a new timeline
+        const ConvertedFrame* first_frame = PeekFrame();
+        if (first_frame != nullptr && first_frame->serial != displayed_video_serial) {
+            // Audio time belongs to the old position until audio decoder notices the seek
+            if (IsAudioOpened() && audio_fifo.serial() != first_frame->serial)
+                return GetCurrentVideoDecal();
+
+            // Converter must not drop frames based on the presentation time of the old position
+            video_presentation_time = -1.0;
+            displayed_video_serial = first_frame->serial;
+            last_video_pts = first_frame->pts;
+            delta_time_accumulator = float(first_frame->pts);
+
+            // Decoding after a seek doesn't say anything about how fast it normally is
+            video_lateness_state = 0;
+        }
+
+        double time_reference;
+
+        // If audio is opened, synchronise video with audio
+        if (IsAudioOpened()) {
+            time_reference = GetAudioTime();
+        }
+        // Otherwise synchronise it based on how much time has passed between function calls (or allow user to mess with delta time if he wants)
+        else {
+            delta_time_accumulator += delta_time;
+            time_reference = delta_time_accumulator;
+        }
+
+        //printf("tr: %lf\n", time_reference);
+
+        //printf("tr: %lf\n", time_reference);
+        //printf("lvpts: %lf\n", last_video_pts);
+
+        // Let converter thread know, that frames before this point won't be displayed
+        video_presentation_time = time_reference;
+
+        // Frames that have to be skipped were decoded for nothing, and lack of frames means decoder can't keep up either
+        const ConvertedFrame* oldest_frame = PeekFrame();
+        AdaptVideoDecodeQuality(time_reference - (oldest_frame != nullptr ? oldest_frame->pts : last_video_pts));
+
+        // If enough time hasn't passed yet, return the same frame
+        if (time_reference < last_video_pts)
+            return GetCurrentVideoDecal();
+
+        while (true) {
+            const ConvertedFrame* next_frame = PeekFrame();
+
+            // Check if Decoding thread has a next video frame at all
+            if (next_frame == nullptr)
+                return GetCurrentVideoDecal();
+
+            last_video_pts = next_frame->pts;
+
+            // Test Decoding thread later by changing "<=" to ">="
+            if (time_reference <= last_video_pts)
+                break;
+
+            SkipVideoFrame();
+        }
+
+        return GetVideoFrame();
+    }
+
+    olc::Decal* Media::GetVideoFrame() {
+        if (IsVideoOpened() == false) {
+            printf("Video isn't open\n");
+            //return nullptr;
+            return GetCurrentVideoDecal();
+        }
+
+        if (FinishedReading()) {
+            //printf("Finished reading video\n");
+            return GetCurrentVideoDecal();
+        }
+
+        // If converter thread wasn't quick enough to convert frames return same image.
+        // (We don't know if converter thread isn't quick enough, or if last video frame 
+        // was decoded, and there are other frames left over, like audio frames)
+        if (PeekFrame() != nullptr) {
+            // Frame was already converted, so only swap pixel buffers. Frame is put into the next sprite of the ring,
+            // so that the decals returned before stay unchanged, and the oldest buffer goes back into the queue,
+            // to be reused by the converter.
+            current_video_frame = (current_video_frame + 1) % video_frames.size();
+            ConvertedFrame& converted_frame = converted_video_fifo.front();
+            std::swap(video_frames[current_video_frame].Sprite()->pColData, converted_frame.pixels);
+
+            if (converted_video_fifo.pop())
+                WakePipelineStage(video_converter_signal);
+
+            UpdateResultSprite();
+        }
+
+        return GetCurrentVideoDecal();
+    }
+
+    // TODO: return error when no more frames are available and there is nothing to skip
+    Media::Result Media::SkipVideoFrame() {
+        if (IsVideoOpened() == false) {
+            printf("Video isn't open\n");
+            return Result::Error;
+        }
+
+        if (FinishedReading()) {
+            printf("Finished reading video\n");
+            return Result::Error;
+        }
+
+        // If converter thread wasn't quick enough to convert frames don't do anything.
+        // (We don't know if converter thread isn't quick enough, or if last video frame 
+        // was decoded, and there are other frames left over, like audio frames)
+        if (PeekFrame() != nullptr) {
+            if (converted_video_fifo.pop())
+                WakePipelineStage(video_converter_signal);
+
+            return Result::ResSuccess;
+        }
+
+        return Result::Error;
+    }
+
+    bool Media::IsVideoOpened() { 
+        return video_opened; 
+    }
+
+    double Media::GetAverageVideoFPS() {
+        return av_q2d(av_format_ctx->streams[video_stream_index]->avg_frame_rate); 
+    }
+
+    Media::VideoDecodeQuality Media::GetVideoDecodeQuality() {
+        return video_decode_quality;
+    }
+
+    int Media::GetVideoWidth() {
+        return video_width;
+    }
+
+    int Media::GetVideoHeight() {
+        return video_height;
+    }
+
+    int64_t Media::GetFrameCount() {
+        if (IsVideoOpened() == false)
+            return 0;
+
+        const StreamIndex* index = GetVideoIndex();
+        if (index != nullptr)
+            return int64_t(index->frame_pts.size());
+
+        return av_format_ctx->streams[video_stream_index]->nb_frames;
+    }
+
+    Media::Result Media::SeekToFrame(int64_t frame) {
+        const StreamIndex* index = GetVideoIndex();
+        if (index == nullptr || frame < 0 || frame >= int64_t(index->frame_pts.size()))
+            return Result::Error;
+
+        // Decoders compare exactly the same value, so the seek stops precisely at this frame
+        return Seek(VideoTimestampToSeconds(index->frame_pts[frame]));
+    }
+
+    void Media::PrintVideoInfo() {
+        if (IsVideoOpened() == false) {
+            printf("Video isn't open\n");
+            return;
+        }
+
+        AVStream* video_stream = av_format_ctx->streams[video_stream_index];
+        double frame_rate = av_q2d(video_stream->avg_frame_rate);
+        int time_base_num = video_stream->time_base.num;
+        int time_base_den = video_stream->time_base.den;
+        int frame_rate_num = video_stream->avg_frame_rate.num;
+        int frame_rate_den = video_stream->avg_frame_rate.den;
+
+        int64_t duration_origin = av_format_ctx->duration;
+        int64_t duration = duration_origin / AV_TIME_BASE;
+        int64_t duration_h = duration / 3600;
+        int64_t duration_min = (duration % 3600) / 60;
+        int64_t duration_sec = duration % 60;
+
+        // Print time base and fps
+        printf("----------------------\n");
+        printf("Video info\n");
+        printf("Codec: %s\n", av_video_codec->long_name);
+        printf("Pixel fmt: %s\n", av_get_pix_fmt_name(av_video_codec_ctx->pix_fmt));
+        printf("YUV converter: %s\n", YuvConverter::GetInstructionSet());
+        printf("Width: %i   Height: %i\n", video_stream->codecpar->width, video_stream->codecpar->height);
+        printf("Output width: %i   Output height: %i\n", video_width, video_height);
+        printf("Duration_origin: %lli\n", duration_origin);
+        printf("Duration: %lli:%lli:%lli h:min:sec\n", duration_h, duration_min, duration_sec);
+        printf("Frame rate: %lf\n", frame_rate);
+        printf("Time base num: %i\n", time_base_num);
+        printf("Time base den: %i\n", time_base_den);
+        printf("Frame rate num: %i\n", frame_rate_num);
+        printf("Frame rate den: %i\n", frame_rate_den);
+        printf("Video delay: %i\n", video_delay);
+
+        // "active_thread_type" is only known after the codec context was opened
+        const char* thread_type_name = "none";
+        if (av_video_codec_ctx->active_thread_type & FF_THREAD_FRAME)
+            thread_type_name = "frame";
+        else if (av_video_codec_ctx->active_thread_type & FF_THREAD_SLICE)
+            thread_type_name = "slice";
+        printf("Decoder threads: %i (%s)\n", av_video_codec_ctx->thread_count, thread_type_name);
+        printf("Video queue: %zu frames (%zu MB max)\n", video_fifo.capacity(), (video_fifo.capacity() * video_frame_bytes + converted_video_fifo.bytes()) / (1024 * 1024));
+        printf("----------------------\n");
+    }
+
+    int Media::GetAudioFrame(void** output, int sample_count) {
+        // Do some error checking
+        if (!output || !(*output) || sample_count < 0)
+            return -1;
+
+        bool wake_decoder = false;
+        int samples_read = audio_fifo.pop(output, sample_count, wake_decoder);
+
+        // Fill the rest of the buffer with silence, in case less samples are stored than requested
+        if (samples_read < sample_count) {
+            size_t sample_bytes = audio_fifo.sample_bytes();
+            memset((uint8_t*)(*output) + samples_read * sample_bytes, 0, (sample_count - samples_read) * sample_bytes);
+        }
+
+        if (wake_decoder)
+            WakePipelineStageFromRealtimeThread(audio_decoder_signal);
+
+        return samples_read;
+    }
+
+    bool Media::IsAudioOpened() {
+        return audio_opened; 
+    }
+
+    void Media::PrintAudioInfo() {
+        if (IsAudioOpened() == false) {
+            printf("Audio isn't open\n");
+            return;
+        }
+        //av_dump_format(av_format_ctx, )
+        //printf("stream count: %u\n", av_format_ctx->nb_streams);
+
+        AVStream* audio_stream = av_format_ctx->streams[audio_stream_index];
+        int frame_size = av_format_ctx->streams[audio_stream_index]->codecpar->frame_size;
+        int sample_rate = av_format_ctx->streams[audio_stream_index]->codecpar->sample_rate;
+        int channels = av_format_ctx->streams[audio_stream_index]->codecpar->channels;
+        int time_base_num = audio_stream->time_base.num;
+        int time_base_den = audio_stream->time_base.den;
+        int pkt_time_base_num = av_audio_codec_ctx->pkt_timebase.num;
+        int pkt_time_base_den = av_audio_codec_ctx->pkt_timebase.den;
+        int ctx_sample_rate = av_audio_codec_ctx->sample_rate;
+
+        int64_t duration_origin = av_format_ctx->duration;
+        int64_t duration = duration_origin / AV_TIME_BASE;
+        int64_t duration_h = duration / 3600;
+        int64_t duration_min = (duration % 3600) / 60;
+        int64_t duration_sec = duration % 60;
+
+        // Print time base and fps
+        printf("----------------------\n");
+        printf("Audio info\n");
+
+        printf("Codec: %s\n", av_audio_codec->long_name);
+        printf("Frame size: %i\n", frame_size);
+        printf("Original format type: %s\n", av_get_sample_fmt_name(GetAudioOriginalFormat()));
+        printf("Output format type: %s\n", av_get_sample_fmt_name(GetAudioOutputFormat()));
+        printf("Duration_origin: %lli\n", duration_origin);
+        printf("Duration: %lli:%lli:%lli h:min:sec\n", duration_h, duration_min, duration_sec);
+        printf("Sample rate: %i\n", sample_rate);
+        printf("Channels: %i\n", channels);
+        printf("Time base num: %i\n", time_base_num);
+        printf("Time base den: %i\n", time_base_den);
+        printf("Packet time base num: %i\n", pkt_time_base_num);
+        printf("Packet time base den: %i\n", pkt_time_base_den);
+        printf("Ctx sample rate: %i\n", ctx_sample_rate);
+        printf("block_align: %i\n", av_format_ctx->streams[audio_stream_index]->codecpar->block_align);
+        printf("initial_padding: %i\n", av_format_ctx->streams[audio_stream_index]->codecpar->initial_padding);
+        printf("trailing_padding: %i\n", av_format_ctx->streams[audio_stream_index]->codecpar->trailing_padding);
+        printf("seek_preroll: %i\n", av_format_ctx->streams[audio_stream_index]->codecpar->seek_preroll);
+        printf("----------------------\n");
+    }
+
+    void Media::SetAudioVolume(float new_volume) {
+        if (IsAudioOpened() == false)
+            return;
+
+        // Clamp volume
+        if (new_volume < 0.0f)
+            new_volume = 0.0f;
+        else if (new_volume > 1.0f)
+            new_volume = 1.0f;
 
-        int GetAudioChannelCount();
+        audio_volume = new_volume;
+        ma_device_set_master_volume(&audio_device, audio_volume);
+    }
 
-        // Returns true if audio format has attached album art (for example album art in .mp3 metadata section)
-        bool HasAlbumArt();
+    float Media::GetAudioVolume() {
+        if (IsAudioOpened() == false)
+            return 0.0;
 
+        return audio_volume;
+    }
 
-    private:
-        // -- Video and audio functions --
-        Result Open(const FileName& filename, bool open_video, bool open_audio, Settings* settings);
-        Result OpenFile(const FileName& filename);
-        void CloseFile();
-        void StartDecodingThread();
-        void StopDecodingThread();
-        Result DecodingThread();
-        // Perform position adjustion after seeking, by consuming the frames up to specified timepoint.
-        // This function works similarly to "DecodingThread()"
-        Result AdjustSeekedPosition(double wanted_timepoint);
-        static const char* GetError(int errnum);
-        // Returns success, if all settings are valid
-        Result ApplySettings();
-        
+    AVSampleFormat Media::GetAudioOutputFormat() {
+        assert(IsAudioOpened());
 
-        // -- Video functions --
-        Result InitVideo();
-        void CloseVideo();
-        void ConvertFrameToRGBASprite(AVFrame* frame, olc::Sprite* target);
-        // Send updated pixel data in olc::Sprite to GPU
-        void UpdateResultSprite();
-        // Calculates video pts in seconds
-        double CalculateVideoPts(const AVFrame* frame);
-        Result HandleVideoDelay();
-        const AVFrame* PeekFrame();
-        static AVPixelFormat CorrectDeprecatedPixelFormat(AVPixelFormat pix_fmt);
+        return audio_format;
+    }
 
-        // -- Audio functions --
-        Result InitAudio();
-        void CloseAudio();
-        // Calculates audio pts in seconds
-        double CalculateAudioPts(const AVFrame* frame);
-        Result ChooseAudioFormat();
-        Result InitialiseAndStartMiniaudio();
-	};
-}
+    AVSampleFormat Media::GetAudioOriginalFormat() {
+        assert(IsAudioOpened());
 
-// Definitions
-namespace olc {
-    Media::Media() {
+        return (AVSampleFormat)av_format_ctx->streams[audio_stream_index]->codecpar->format;
     }
 
-    Media::~Media() {
-        Close();
+    int Media::GetAudioSampleSize() {
+        assert(IsAudioOpened());
+
+        return audio_sample_size;
+    }
+
+    int Media::GetAudioSampleRate() {
+        assert(IsAudioOpened());
+
+        return audio_sample_rate;
+    }
+
+    int Media::GetAudioChannelCount() {
+        assert(IsAudioOpened());
+
+        return audio_channel_count;
+    }
+
+    bool Media::HasAlbumArt() {
+        return attached_pic;
+    }
+
+    Media::Result Media::Open(const MediaSource& source, bool open_video, bool open_audio, Settings* playback_settings) {
+        Result result;
+
+        if (playback_settings != nullptr)
+            settings = *playback_settings;
+
+        result = ApplySettings();
+        if (result != Result::ResSuccess)
+            return result;
+
+        // If media is already open, close it first
+        if (IsVideoOpened() || IsAudioOpened()) {
+            Close();
+        }
+
+        result = OpenFile(source);
+        if (result != Result::ResSuccess)
+            return result;
+
+        // Opened video won't be paused, even if the previous video was paused, to avoid possible confusion
+        is_paused = false;
+
+        if (open_video) {
+            result = InitVideo();
+            if (result != Result::ResSuccess)
+                return result;
+        }
+
+        if (open_audio) {
+            result = InitAudio();
+            if (result != Result::ResSuccess) {
+                return result;
+            }
+        }
+
+        DiscardUnusedStreams();
+
+        // Live input can't be read a second time
+        if (settings.live_input == false && (settings.build_index || settings.index_cache_path.empty() == false))
+            StartIndexing(source);
+
+        StartDecodingThread();
+
+        return Result::ResSuccess;
+    }
+
+    Media::Result Media::OpenFile(const MediaSource& source) {
+        int response;
+
+        av_format_ctx = avformat_alloc_context();
+        OLC_MEDIA_ASSERT(av_format_ctx != nullptr, "Couldn't allocate AVFormatContext");
+
+        OLC_MEDIA_ASSERT(ioCtx.initAVFmtCtx(source, av_format_ctx, settings) == true, "Couldn't initialize AVFormatContext: most likely couldn't find/open file");
+
+        // Live input is demuxed with as little buffering as possible, to keep the latency low
+        if (settings.live_input) {
+            av_format_ctx->flags |= AVFMT_FLAG_NOBUFFER;
+            av_format_ctx->probesize = settings.live_probe_size;
+            av_format_ctx->format_probesize = int(std::min<int64_t>(settings.live_probe_size, INT32_MAX));
+            av_format_ctx->max_analyze_duration = int64_t(settings.live_analyze_duration * AV_TIME_BASE);
+        }
+
+        response = avformat_open_input(&av_format_ctx, "", NULL, NULL);
+        if (response < 0) {
+            printf("avformat_open_input response: %s\n", GetError(response));
+        }
+        OLC_MEDIA_ASSERT(response == 0, "Couldn't open file: most likely format isn't supported");
+
+        response = avformat_find_stream_info(av_format_ctx, nullptr);
+        OLC_MEDIA_ASSERT(response >= 0, "Couldn't find stream info");
+
+        av_demuxer_packet = av_packet_alloc();
+        OLC_MEDIA_ASSERT(av_demuxer_packet != nullptr, "Couldn't allocate AVPacket");
+
+        return Result::ResSuccess;
+    }
+
+    void Media::DiscardUnusedStreams() {
+        for (unsigned int i = 0; i < av_format_ctx->nb_streams; i++) {
+            bool used = (IsVideoOpened() && int(i) == video_stream_index) || (IsAudioOpened() && int(i) == audio_stream_index);
+            av_format_ctx->streams[i]->discard = used ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+        }
+    }
+
+    void Media::CloseFile() {
+        av_packet_free(&av_demuxer_packet);
+        video_packets.clear();
+        audio_packets.clear();
+
+        avformat_close_input(&av_format_ctx);
+
+        // Don't think this function is really needed, but I put it here for sanity reasons
+        avformat_free_context(av_format_ctx);
+
+        ioCtx.closeIO();
+    }
+
+    void Media::StartDecodingThread() {
+        printf("Starting threads\n");
+        keep_loading = true;
+        demuxer_reached_end = false;
+        seek_serial = 0;
+
+        video_decoder_draining = false;
+        video_decoder_finished = false;
+        video_decoder_serial = 0;
+        video_seek_target = -1.0;
+        displayed_video_serial = 0;
+
+        audio_decoder_draining = false;
+        audio_decoder_finished = false;
+        audio_decoder_serial = 0;
+        audio_seek_target = -1.0;
+        pending_audio_samples = 0;
+        pending_audio_offset = 0;
+
+        if ((IsVideoOpened() || IsAudioOpened()) == false)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(seek_mutex);
+            accepting_seeks = true;
+        }
+
+        StartPipelineStage(PipelineStage::Demuxer, demuxer_thread);
+
+        if (IsVideoOpened()) {
+            StartPipelineStage(PipelineStage::VideoDecoder, video_decoder_thread);
+            StartPipelineStage(PipelineStage::VideoConverter, video_converter_thread);
+        }
+
+        if (IsAudioOpened()) {
+            StartPipelineStage(PipelineStage::AudioDecoder, audio_decoder_thread);
+
+            // Audio glitches are far more noticeable than late video frames, so make sure
+            // audio decoding doesn't get starved by video decoding spikes.
+            // (On executor audio has the earliest deadlines, as its buffer is the shortest)
+            if (audio_decoder_thread.joinable())
+                RaiseThreadPriority(audio_decoder_thread);
+        }
+    }
+
+    void Media::StartPipelineStage(PipelineStage stage, std::thread& thread) {
+        if (settings.executor == nullptr) {
+            thread = std::thread(&Media::PipelineThread, this, stage);
+            return;
+        }
+
+        PipelineSignal& signal = GetPipelineSignal(stage);
+        signal.executor = settings.executor;
+        executor_stages.push_back(stage);
+        settings.executor->Submit(&signal.task);
+    }
+
+    void Media::StopDecodingThread() {
+        keep_loading = false;
+
+        WakePipelineStage(demuxer_signal);
+        WakePipelineStage(video_decoder_signal);
+        WakePipelineStage(video_converter_signal);
+        WakePipelineStage(audio_decoder_signal);
+
+        if (demuxer_thread.joinable())
+            demuxer_thread.join();
+
+        if (video_decoder_thread.joinable())
+            video_decoder_thread.join();
+
+        if (video_converter_thread.joinable())
+            video_converter_thread.join();
+
+        if (audio_decoder_thread.joinable())
+            audio_decoder_thread.join();
+
+        // Tasks finish on their own once they notice "keep_loading" is false
+        for (PipelineStage stage : executor_stages) {
+            PipelineSignal& signal = GetPipelineSignal(stage);
+            signal.executor->WaitUntilDone(&signal.task);
+            signal.executor = nullptr;
+        }
+        executor_stages.clear();
+    }
+
+    void Media::PipelineThread(PipelineStage stage) {
+        RunPipelineStage(stage);
+        FinishPipelineStage(stage);
+    }
+
+    Media::StepResult Media::RunPipelineStep(PipelineStage stage) {
+        switch (stage) {
+        case PipelineStage::Demuxer:        return DemuxStep();
+        case PipelineStage::VideoDecoder:   return DecodeVideoStep();
+        case PipelineStage::VideoConverter: return ConvertVideoStep();
+        case PipelineStage::AudioDecoder:   return DecodeAudioStep();
+        default:                            return StepResult::Error;
+        }
+    }
+
+    void Media::FinishPipelineStage(PipelineStage stage) {
+        switch (stage) {
+        case PipelineStage::Demuxer:
+            // Let decoders drain packets that were already read
+            video_packets.finish();
+            audio_packets.finish();
+            WakePipelineStage(video_decoder_signal);
+            WakePipelineStage(audio_decoder_signal);
+            printf("Demuxer finished\n");
+            break;
+
+        case PipelineStage::VideoDecoder:
+            video_decoder_finished = true;
+            WakePipelineStage(video_converter_signal);
+            printf("Video decoder finished\n");
+            break;
+
+        case PipelineStage::VideoConverter:
+            printf("Video converter finished\n");
+            break;
+
+        case PipelineStage::AudioDecoder:
+            audio_decoder_finished = true;
+            printf("Audio decoder finished\n");
+            break;
+        }
+
+        // Seeks can't complete without all the stages running
+        FailSeeks();
+    }
+
+    Media::PipelineSignal& Media::GetPipelineSignal(PipelineStage stage) {
+        switch (stage) {
+        case PipelineStage::VideoDecoder:   return video_decoder_signal;
+        case PipelineStage::VideoConverter: return video_converter_signal;
+        case PipelineStage::AudioDecoder:   return audio_decoder_signal;
+        case PipelineStage::Demuxer:
+        default:                            return demuxer_signal;
+        }
+    }
+
+    double Media::GetPipelineBufferedTime(PipelineStage stage) {
+        double frame_duration = GetVideoFrameDuration();
+
+        double converted_time = IsVideoOpened() ? converted_video_fifo.size() * frame_duration : 0.0;
+        double video_time = IsVideoOpened() ? converted_time + video_fifo.size() * frame_duration : 0.0;
+        double audio_time_left = IsAudioOpened() ? double(audio_fifo.size()) / double(audio_sample_rate) : 0.0;
+
+        switch (stage) {
+        case PipelineStage::VideoDecoder:   return video_time;
+        case PipelineStage::VideoConverter: return converted_time;
+        case PipelineStage::AudioDecoder:   return audio_time_left;
+        // Demuxer feeds both decoders, so it's as urgent as the most urgent of them
+        case PipelineStage::Demuxer:
+        default:
+            if (IsVideoOpened() && IsAudioOpened())
+                return std::min(video_time, audio_time_left);
+            return IsVideoOpened() ? video_time : audio_time_left;
+        }
+    }
+
+    MediaExecutor::TaskResult Media::PipelineTask::Step() {
+        if (media->keep_loading) {
+            StepResult result = media->RunPipelineStep(stage);
+
+            if (result == StepResult::Progressed)
+                return MediaExecutor::TaskResult::Continue;
+
+            // Finished stage waits for a seek
+            if (result == StepResult::Blocked || result == StepResult::Finished)
+                return MediaExecutor::TaskResult::Park;
+        }
+
+        media->FinishPipelineStage(stage);
+        return MediaExecutor::TaskResult::Done;
+    }
+
+    std::chrono::steady_clock::time_point Media::PipelineTask::Deadline() {
+        auto buffered_time = std::chrono::duration<double>(media->GetPipelineBufferedTime(stage));
+        return std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(buffered_time);
+    }
+
+    void Media::RunPipelineStage(PipelineStage stage) {
+        PipelineSignal& signal = GetPipelineSignal(stage);
+
+        while (keep_loading) {
+            // Remember generation before doing the step, so that wake ups that happen
+            // while the step is running aren't lost
+            uint64_t generation = signal.generation;
+
+            StepResult result = RunPipelineStep(stage);
+
+            if (result == StepResult::Error)
+                break;
+
+            // Finished stage waits for a seek
+            if (result == StepResult::Blocked || result == StepResult::Finished) {
+                auto woken_up = [&]() {
+                    return keep_loading == false || signal.generation != generation;
+                };
+
+                std::unique_lock<std::mutex> lock(mutex);
+                if (signal.poll_interval.count() > 0)
+                    signal.conditional.wait_for(lock, signal.poll_interval, woken_up);
+                else
+                    signal.conditional.wait(lock, woken_up);
+            }
+        }
+    }
+
+    void Media::WakePipelineStage(PipelineSignal& signal) {
+        if (signal.executor != nullptr) {
+            signal.executor->Wake(&signal.task);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++signal.generation;
+        }
+
+        signal.conditional.notify_one();
+    }
+
+    void Media::WakePipelineStageFromRealtimeThread(PipelineSignal& signal) {
+        if (signal.executor != nullptr) {
+            signal.executor->WakeFromRealtimeThread(&signal.task);
+            return;
+        }
+
+        // Locking "mutex" here could make real-time thread wait for a lower priority thread
+        ++signal.generation;
+        signal.conditional.notify_one();
+    }
+
+    Media::StepResult Media::DemuxStep() {
+        // Seeking is done here, as "av_format_ctx" is only used by demuxer thread
+        if (ProcessSeekRequest())
+            return StepResult::Progressed;
+
+        if (demuxer_reached_end)
+            return StepResult::Finished;
+
+        if (HasEnoughQueuedPackets())
+            return StepResult::Blocked;
+
+        // Try reading next packet
+        int response = av_read_frame(av_format_ctx, av_demuxer_packet);
+
+        // Let decoders drain remaining packets if error or end of file was encountered
+        if (response < 0) {
+            printf("Error or end of file happened\n");
+            printf("Exit info: %s\n", GetError(response));
+
+            video_packets.finish();
+            audio_packets.finish();
+            WakePipelineStage(video_decoder_signal);
+            WakePipelineStage(audio_decoder_signal);
+
+            // TODO: check if response is error or end of file
+            demuxer_reached_end = true;
+            return StepResult::Finished;
+        }
+
+        if (IsVideoOpened() && av_demuxer_packet->stream_index == video_stream_index) {
+            OLC_MEDIA_ASSERT_RETURN(video_packets.push(av_demuxer_packet) == Result::ResSuccess, "Couldn't queue video packet", StepResult::Error);
+            WakePipelineStage(video_decoder_signal);
+        }
+        else if (IsAudioOpened() && av_demuxer_packet->stream_index == audio_stream_index) {
+            OLC_MEDIA_ASSERT_RETURN(audio_packets.push(av_demuxer_packet) == Result::ResSuccess, "Couldn't queue audio packet", StepResult::Error);
+            WakePipelineStage(audio_decoder_signal);
+        }
+
+        av_packet_unref(av_demuxer_packet);
+
+        return StepResult::Progressed;
     }
 
-    Media::Result Media::Open(const std::string& filename, bool open_video, bool open_audio, Settings* settings) {
-        return Open(FileName{ filename.c_str() }, open_video, open_audio, settings);
+    bool Media::HasEnoughQueuedPackets() {
+        if (video_packets.bytes() + audio_packets.bytes() >= max_queued_packet_bytes)
+            return true;
+
+        // Keep on reading while any stream is low on packets, even if other stream already has plenty of them.
+        // This way audio decoder gets its packets even when video decoder is busy.
+        bool video_has_enough = IsVideoOpened() == false || HasAlbumArt() || video_packets.size() >= min_queued_packets;
+        bool audio_has_enough = IsAudioOpened() == false || audio_packets.size() >= min_queued_packets;
+
+        return video_has_enough && audio_has_enough;
     }
 
+    void Media::RaiseThreadPriority(std::thread& thread) {
+        // This is only a hint, so failures are ignored
 #ifdef _WIN32
-    Media::Result Media::Open(const std::wstring& filename, bool open_video, bool open_audio, Settings* settings) {
-        return Open(FileName{ filename.c_str() }, open_video, open_audio, settings);
-    }
+        SetThreadPriority(thread.native_handle(), THREAD_PRIORITY_ABOVE_NORMAL);
+#else
+        // Usually requires elevated privileges, in which case thread stays with the default priority
+        sched_param param;
+        param.sched_priority = sched_get_priority_min(SCHED_RR);
+        pthread_setschedparam(thread.native_handle(), SCHED_RR, &param);
 #endif // _WIN32
-
-    void Media::Close() {
-        StopDecodingThread();
-        CloseFile();
-        CloseVideo();
-        CloseAudio();
     }
 
-    bool Media::FinishedReading() {
-        // If neither of the streams were open, return false
-        if (IsVideoOpened() == false && IsAudioOpened() == false)
-            return false;
+    bool Media::ProcessSeekRequest() {
+        double target;
+        size_t request_count;
+        std::chrono::steady_clock::time_point start;
 
-        // Check if decoding thread has finished and all the frames were read from the streams that were open
-        if (finished_reading) {
-            bool video_finished = true;
-            bool audio_finished = true;
+        {
+            std::lock_guard<std::mutex> lock(seek_mutex);
+            if (seek_requested == false)
+                return false;
+
+            seek_requested = false;
+            target = requested_seek_time;
+            start = requested_seek_start;
+            // Seeks requested after this point will have to wait for the next seek
+            request_count = requested_seeks.size();
+        }
 
-            if (IsVideoOpened() && video_fifo.size() > 0) {
-                video_finished = false;
+        // "av_seek_frame" won't actually make next received frames to be what we want, instead, it will 
+        // seek back to nearest keyframe from the given timepoint.
+        // So decoders have to skip the frames up to the timepoint themselves.
+        int response;
+        const StreamIndex* video_index = GetVideoIndex();
+        if (video_index != nullptr && video_index->keyframes.empty() == false) {
+            // Demuxer without an index of its own would search the file for the timestamp (MPEG-TS, raw streams)
+            if (demuxer_has_index == false) {
+                AddDemuxerIndexEntries(*video_index);
+                demuxer_has_index = true;
             }
 
-            if (IsAudioOpened() && audio_fifo.size() > 0) {
-                audio_finished = false;
+            // Index knows exactly which keyframe has to be decoded first
+            const IndexEntry& keyframe = video_index->packets[FindSeekKeyframe(*video_index, target)];
+            int64_t timestamp = keyframe.dts != AV_NOPTS_VALUE ? keyframe.dts : keyframe.pts;
+            response = av_seek_frame(av_format_ctx, video_stream_index, timestamp, AVSEEK_FLAG_BACKWARD);
+        }
+        else {
+            response = av_seek_frame(av_format_ctx, -1, int64_t(AV_TIME_BASE * target), AVSEEK_FLAG_BACKWARD);
+        }
+
+        // Album art is a single frame that is only read once, so it can't be seeked
+        bool seek_video = IsVideoOpened() && HasAlbumArt() == false;
+        int serial = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(seek_mutex);
+            auto first = requested_seeks.begin();
+            auto last = requested_seeks.begin() + request_count;
+
+            // Continue decoding even if seek wasn't successful
+            if (response < 0) {
+                for (auto it = first; it != last; ++it)
+                    it->set_value(Result::Error);
             }
+            else {
+                // Seek that decoders didn't finish yet is superseded by this one, so it completes together with it.
+                // Active seek is set up before flushing packet queues, so that decoders can't complete it too early.
+                active_seeks.insert(active_seeks.end(), std::make_move_iterator(first), std::make_move_iterator(last));
+                serial = ++seek_serial;
+                active_seek_serial = serial;
+                active_seek_stages = int(seek_video) + int(IsAudioOpened());
+                active_seek_start = start;
+
+                if (active_seek_stages == 0)
+                    ResolveActiveSeeks();
+            }
+
+            requested_seeks.erase(first, last);
+            UpdateSeekingState();
+        }
 
-            return video_finished && audio_finished;
+        if (response < 0) {
+            printf("Seek failed: %s\n", GetError(response));
+            return true;
+        }
+
+        demuxer_reached_end = false;
+
+        if (seek_video) {
+            video_packets.flush(serial, target);
+            WakePipelineStage(video_decoder_signal);
         }
 
-        return false;
+        if (IsAudioOpened()) {
+            audio_packets.flush(serial, target);
+            WakePipelineStage(audio_decoder_signal);
+        }
+
+        return true;
     }
 
-    void Media::Pause() {
-        if ((IsAudioOpened() || IsVideoOpened()) == false)
+    void Media::CompleteSeekStage(int serial) {
+        std::lock_guard<std::mutex> lock(seek_mutex);
+
+        if (serial != active_seek_serial || active_seek_stages == 0)
             return;
 
-        if (IsPaused())
+        if (--active_seek_stages > 0)
             return;
 
-        if (IsAudioOpened())
-            ma_device_stop(&audio_device);
+        ResolveActiveSeeks();
+        UpdateSeekingState();
+    }
 
-        is_paused = true;
+    void Media::ResolveActiveSeeks() {
+        std::chrono::duration<double> latency = std::chrono::steady_clock::now() - active_seek_start;
+        last_seek_latency = latency.count();
+
+        for (std::promise<Result>& seek : active_seeks)
+            seek.set_value(Result::ResSuccess);
+        active_seeks.clear();
     }
-    
-    void Media::Play() {
-        if ((IsAudioOpened() || IsVideoOpened()) == false)
-            return;
 
-        if (IsPaused() == false)
-            return;
+    void Media::FailSeeks() {
+        std::lock_guard<std::mutex> lock(seek_mutex);
 
-        if (IsAudioOpened())
-            ma_device_start(&audio_device);
+        for (std::promise<Result>& seek : requested_seeks)
+            seek.set_value(Result::Error);
+        for (std::promise<Result>& seek : active_seeks)
+            seek.set_value(Result::Error);
 
-        is_paused = false;
+        requested_seeks.clear();
+        active_seeks.clear();
+        active_seek_stages = 0;
+        seek_requested = false;
+        accepting_seeks = false;
+
+        UpdateSeekingState();
     }
 
-    bool Media::IsPaused() {
-        return is_paused;
+    void Media::UpdateSeekingState() {
+        seeking = requested_seeks.empty() == false || active_seeks.empty() == false;
     }
 
-    Media::Result Media::Seek(double new_time) {
-        //Piratimer::start("BigSeek");
+    void Media::StartIndexing(const MediaSource& source) {
+        keep_indexing = true;
+        index_ready = false;
 
-        if ((IsVideoOpened() || IsAudioOpened()) == false)
-            return Result::Error;
+        // Only video is seeked with the index
+        if (IsVideoOpened() == false || HasAlbumArt())
+            return;
 
-        Pause();
-        StopDecodingThread();
+        index_streams.resize(av_format_ctx->nb_streams);
+        for (unsigned int i = 0; i < av_format_ctx->nb_streams; ++i) {
+            index_streams[i].codec_id = av_format_ctx->streams[i]->codecpar->codec_id;
+            index_streams[i].time_base = av_format_ctx->streams[i]->time_base;
+        }
+        index_duration = av_format_ctx->duration;
+        index_video_stream = video_stream_index;
+        demuxer_has_index = avformat_index_get_entries_count(av_format_ctx->streams[video_stream_index]) > 0;
 
-        Result result = Result::ResSuccess;
-        int response = av_seek_frame(av_format_ctx, -1, int64_t(AV_TIME_BASE * new_time), AVSEEK_FLAG_BACKWARD);
-        //int response = av_seek_frame(av_format_ctx, -1, int64_t(AV_TIME_BASE * new_time), AVSEEK_FLAG_ANY);
+        // Reading the whole file isn't needed, if the container lists every packet already
+        if (LoadContainerIndex()) {
+            index_ready = true;
+            return;
+        }
 
-        // If seeking was successful
-        if (response >= 0) {
-            if (IsVideoOpened()) {
-                video_fifo.clear();
-                avcodec_flush_buffers(av_video_codec_ctx);
-            }
+        // Index thread reads the same opened file at its own position, instead of opening it again
+        MediaSource index_source = source;
+        index_source.shared_file = ioCtx.sharedFile();
 
-            if (IsAudioOpened()) {
-                audio_fifo.clear();
-                avcodec_flush_buffers(av_audio_codec_ctx);
+        // Custom source can't be read by two threads, so the index thread gets its own copy
+        if (source.io_source) {
+            index_source.io_source = source.io_source->Clone();
+            if (index_source.io_source == nullptr) {
+                printf("IO source can't be cloned, so index won't be built\n");
+                return;
             }
-
-            //Piratimer::start("Seek");
-            // "av_seek_frame" won't actually make next received frames to be what we want, instead, it will 
-            // seek back to nearest keyframe from the given timepoint.
-            // So we have to consume the frames up to the timepoint we want.
-            result = AdjustSeekedPosition(new_time);
-            //Piratimer::end("Seek");
-        }
-        else {
-            result = Result::Error;
         }
 
-        // Continue decoding and playing even if seek wasn't successful
-        StartDecodingThread();
-        Play();
+        // File is opened here, as filename of the source might not outlive this call
+        index_format_ctx = avformat_alloc_context();
+        if (index_format_ctx == nullptr || index_io_ctx.initAVFmtCtx(index_source, index_format_ctx, settings) == false) {
+            printf("Couldn't open file for indexing\n");
+            avformat_free_context(index_format_ctx);
+            index_format_ctx = nullptr;
+            index_io_ctx.closeIO();
+            return;
+        }
 
-        //Piratimer::end("BigSeek");
+        // Index cache is only used for the same source
+        index_source_size = index_io_ctx.size();
+        index_source_mtime = source.filename != nullptr ? SharedFile::modificationTime(*source.filename) : 0;
 
-        return result;
+        index_thread = std::thread(&Media::IndexThread, this);
     }
 
-    double Media::GetCurrentPlaybackTime() {
-        double time = 0.0;
+    void Media::StopIndexing() {
+        keep_indexing = false;
 
-        if (IsVideoOpened()) {
-            time = last_video_pts;
-        }
-        else if (IsAudioOpened()) {
-            time = audio_time;
-        }
+        if (index_thread.joinable())
+            index_thread.join();
 
-        return time;
+        index_ready = false;
+        stream_indices.clear();
+        index_streams.clear();
+        index_video_stream = -1;
+        demuxer_has_index = true;
     }
 
-    olc::Decal* Media::GetVideoFrame(float delta_time) {
-        //printf("video fifo size %llu\n", video_fifo.size());
+    void Media::IndexThread() {
+        bool loaded = settings.index_cache_path.empty() == false && LoadIndexCache() == Result::ResSuccess;
 
-        if (IsVideoOpened() == false) {
-            printf("Video isn't open\n");
-            return nullptr;
-        }
+        if (loaded == false && settings.build_index && BuildIndex() == Result::ResSuccess) {
+            loaded = true;
 
-        if (FinishedReading()) {
-            //printf("Finished reading video\n");
-            return GetVideoFrame();
+            if (settings.index_cache_path.empty() == false && SaveIndexCache() != Result::ResSuccess)
+                printf("Couldn't save index to \"%s\"\n", settings.index_cache_path.c_str());
         }
 
-        // This returned video frame might be empty
-        if (IsPaused()) {
-            return video_frame.Decal();
-        }
+        // Index thread won't read the file anymore
+        avformat_close_input(&index_format_ctx);
+        avformat_free_context(index_format_ctx);
+        index_format_ctx = nullptr;
+        index_io_ctx.closeIO();
 
-        if (HasAlbumArt()) {
-            return GetVideoFrame();
+        if (loaded) {
+            index_ready = true;
+            printf("Index ready\n");
         }
+    }
 
-        double time_reference;
+    bool Media::LoadContainerIndex() {
+        AVStream* stream = av_format_ctx->streams[video_stream_index];
+        int entry_count = avformat_index_get_entries_count(stream);
+        if (entry_count <= 0)
+            return false;
 
-        // If audio is opened, synchronise video with audio
-        if (IsAudioOpened()) {
-            time_reference = audio_time;
+        StreamIndex index;
+        bool has_non_keyframes = false;
+        for (int i = 0; i < entry_count; ++i) {
+            const AVIndexEntry* container_entry = avformat_index_get_entry(stream, i);
+            if (container_entry == nullptr || (container_entry->flags & AVINDEX_DISCARD_FRAME) != 0)
+                continue;
+
+            // Containers only store decoding timestamps
+            IndexEntry entry;
+            entry.dts = container_entry->timestamp;
+            entry.pos = container_entry->pos;
+            entry.keyframe = (container_entry->flags & AVINDEX_KEYFRAME) != 0;
+            has_non_keyframes |= entry.keyframe == false;
+            index.packets.push_back(entry);
         }
-        // Otherwise synchronise it based on how much time has passed between function calls (or allow user to mess with delta time if he wants)
-        else {
-            delta_time_accumulator += delta_time;
-            time_reference = delta_time_accumulator;
-        }
-
-        //printf("tr: %lf\n", time_reference);
 
-        //printf("tr: %lf\n", time_reference);
-        //printf("lvpts: %lf\n", last_video_pts);
+        // Index of keyframes only (like Matroska cues) can't count frames, unless every frame is a keyframe
+        if (has_non_keyframes == false && int64_t(index.packets.size()) != stream->nb_frames)
+            return false;
 
-        // If enough time hasn't passed yet, return the same frame
-        if (time_reference < last_video_pts)
-            return video_frame.Decal();
+        FinishStreamIndex(index);
 
-        while (true) {
-            const AVFrame* next_frame = PeekFrame();
+        // Frames are displayed later than they are decoded by the reordering delay, which is the same for every frame
+        if (stream->start_time != AV_NOPTS_VALUE && index.frame_pts.empty() == false) {
+            int64_t delay = stream->start_time - index.frame_pts.front();
+            for (int64_t& pts : index.frame_pts)
+                pts += delay;
+        }
 
-            // Check if Decoding thread has a next video frame at all
-            if (next_frame == nullptr)
-                return video_frame.Decal();
+        stream_indices.assign(index_streams.size(), StreamIndex());
+        stream_indices[video_stream_index] = std::move(index);
 
-            last_video_pts = CalculateVideoPts(next_frame);
+        return true;
+    }
 
-            // Test Decoding thread later by changing "<=" to ">="
-            if (time_reference <= last_video_pts)
-                break;
+    void Media::AddDemuxerIndexEntries(const StreamIndex& index) {
+        AVStream* stream = av_format_ctx->streams[video_stream_index];
+        for (size_t keyframe : index.keyframes) {
+            const IndexEntry& packet = index.packets[keyframe];
+            int64_t timestamp = packet.dts != AV_NOPTS_VALUE ? packet.dts : packet.pts;
 
-            SkipVideoFrame();
+            // Demuxer reads from the position of the entry, so keyframes without one can't be used
+            if (packet.pos >= 0)
+                av_add_index_entry(stream, packet.pos, timestamp, 0, 0, AVINDEX_KEYFRAME);
         }
-
-        return GetVideoFrame();
     }
 
-    olc::Decal* Media::GetVideoFrame() {
-        if (IsVideoOpened() == false) {
-            printf("Video isn't open\n");
-            //return nullptr;
-            return video_frame.Decal();
+    Media::Result Media::BuildIndex() {
+        int response = avformat_open_input(&index_format_ctx, "", NULL, NULL);
+        OLC_MEDIA_ASSERT(response == 0, "Couldn't open file for indexing");
+
+        std::vector<StreamIndex> indices(index_streams.size());
+
+        // Demuxer doesn't have to return packets of streams that aren't indexed
+        for (unsigned int i = 0; i < index_format_ctx->nb_streams; ++i) {
+            index_format_ctx->streams[i]->discard = IsIndexedStream(int(i)) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
         }
 
-        if (FinishedReading()) {
-            //printf("Finished reading video\n");
-            return video_frame.Decal();
+        AVPacket* packet = av_packet_alloc();
+        OLC_MEDIA_ASSERT(packet != nullptr, "Couldn't allocate AVPacket");
+
+        while (keep_indexing) {
+            response = av_read_frame(index_format_ctx, packet);
+            if (response < 0)
+                break;
+
+            if (IsIndexedStream(packet->stream_index)) {
+                IndexEntry entry;
+                entry.pts = packet->pts;
+                entry.dts = packet->dts;
+                entry.pos = packet->pos;
+                entry.keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+                indices[packet->stream_index].packets.push_back(entry);
+            }
+
+            av_packet_unref(packet);
         }
 
-        // If decoding thread wasn't quick enough to decode frames return same image.
-        // (We don't know if decoding thread isn't quick enough, or if last video frame 
-        // was decoded, and there are other frames left over, like audio frames)
-        if (video_fifo.size() > 0) {
-            //printf("v-\n");
+        av_packet_free(&packet);
 
-            AVFrame* frame_ref = video_fifo.front();
+        // Index of partially read file would give wrong answers
+        if (keep_indexing == false || response != AVERROR_EOF)
+            return Result::Error;
 
-            ConvertFrameToRGBASprite(frame_ref, video_frame.Sprite());
-            //UpdateResultSprite();
+        for (StreamIndex& index : indices)
+            FinishStreamIndex(index);
 
-            //printf("vt: %lf\n", double(frame_ref->best_effort_timestamp * video_time_base.num) / double(video_time_base.den));
+        stream_indices = std::move(indices);
 
-            video_fifo.pop();
+        return Result::ResSuccess;
+    }
 
-            conditional.notify_one();
-        }
+    template<typename T>
+    bool Media::WriteIndexValue(FILE* file, const T& value) {
+        return fwrite(&value, sizeof(T), 1, file) == 1;
+    }
 
-        return video_frame.Decal();
+    template<typename T>
+    bool Media::ReadIndexValue(FILE* file, T& value) {
+        return fread(&value, sizeof(T), 1, file) == 1;
     }
 
-    // TODO: return error when no more frames are available and there is nothing to skip
-    Media::Result Media::SkipVideoFrame() {
-        if (IsVideoOpened() == false) {
-            printf("Video isn't open\n");
+    Media::Result Media::LoadIndexCache() {
+        FILE* file = fopen(settings.index_cache_path.c_str(), "rb");
+        if (file == nullptr)
             return Result::Error;
+
+        std::vector<StreamIndex> indices(index_streams.size());
+
+        // Cache is only used if it describes the same streams as the opened media
+        char magic[sizeof(index_cache_magic)];
+        uint32_t version;
+        int64_t source_size, source_mtime, duration;
+        uint32_t stream_count;
+        bool valid = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, index_cache_magic, sizeof(magic)) == 0 &&
+            ReadIndexValue(file, version) && version == index_cache_version &&
+            ReadIndexValue(file, source_size) && source_size == index_source_size &&
+            ReadIndexValue(file, source_mtime) && source_mtime == index_source_mtime &&
+            ReadIndexValue(file, duration) && duration == index_duration &&
+            ReadIndexValue(file, stream_count) && stream_count == index_streams.size();
+
+        for (uint32_t i = 0; valid && i < stream_count; ++i) {
+            const IndexedStreamInfo& stream = index_streams[i];
+            int32_t codec_id, time_base_num, time_base_den;
+            uint64_t packet_count;
+
+            valid = ReadIndexValue(file, codec_id) && codec_id == int32_t(stream.codec_id) &&
+                ReadIndexValue(file, time_base_num) && time_base_num == stream.time_base.num &&
+                ReadIndexValue(file, time_base_den) && time_base_den == stream.time_base.den &&
+                ReadIndexValue(file, packet_count);
+
+            for (uint64_t j = 0; valid && j < packet_count && keep_indexing; ++j) {
+                IndexEntry entry;
+                uint8_t keyframe;
+                valid = ReadIndexValue(file, entry.pts) && ReadIndexValue(file, entry.dts) &&
+                    ReadIndexValue(file, entry.pos) && ReadIndexValue(file, keyframe);
+                entry.keyframe = keyframe != 0;
+
+                // Streams that aren't opened are skipped, but still have to be read
+                if (IsIndexedStream(int(i)))
+                    indices[i].packets.push_back(entry);
+            }
         }
 
-        if (FinishedReading()) {
-            printf("Finished reading video\n");
+        fclose(file);
+
+        if (valid == false || keep_indexing == false)
+            return Result::Error;
+
+        for (StreamIndex& index : indices)
+            FinishStreamIndex(index);
+
+        stream_indices = std::move(indices);
+
+        return Result::ResSuccess;
+    }
+
+    Media::Result Media::SaveIndexCache() {
+        FILE* file = fopen(settings.index_cache_path.c_str(), "wb");
+        if (file == nullptr)
             return Result::Error;
+
+        bool valid = fwrite(index_cache_magic, sizeof(index_cache_magic), 1, file) == 1 &&
+            WriteIndexValue(file, index_cache_version) &&
+            WriteIndexValue(file, index_source_size) &&
+            WriteIndexValue(file, index_source_mtime) &&
+            WriteIndexValue(file, index_duration) &&
+            WriteIndexValue(file, uint32_t(stream_indices.size()));
+
+        for (size_t i = 0; valid && i < stream_indices.size(); ++i) {
+            const IndexedStreamInfo& stream = index_streams[i];
+
+            valid = WriteIndexValue(file, int32_t(stream.codec_id)) &&
+                WriteIndexValue(file, int32_t(stream.time_base.num)) &&
+                WriteIndexValue(file, int32_t(stream.time_base.den)) &&
+                WriteIndexValue(file, uint64_t(stream_indices[i].packets.size()));
+
+            for (size_t j = 0; valid && j < stream_indices[i].packets.size(); ++j) {
+                const IndexEntry& entry = stream_indices[i].packets[j];
+                valid = WriteIndexValue(file, entry.pts) && WriteIndexValue(file, entry.dts) &&
+                    WriteIndexValue(file, entry.pos) && WriteIndexValue(file, uint8_t(entry.keyframe));
+            }
         }
 
-        // If decoding thread wasn't quick enough to decode frames don't do anything.
-        // (We don't know if decoding thread isn't quick enough, or if last video frame 
-        // was decoded, and there are other frames left over, like audio frames)
-        if (video_fifo.size() > 0) {
-            video_fifo.pop();
+        valid = fclose(file) == 0 && valid;
 
-            conditional.notify_one();
+        return valid ? Result::ResSuccess : Result::Error;
+    }
 
-            return Result::ResSuccess;
+    bool Media::IsIndexedStream(int stream_index) {
+        if (stream_index < 0 || stream_index >= int(index_streams.size()))
+            return false;
+
+        // Only "GetVideoIndex()" is ever used
+        return stream_index == index_video_stream;
+    }
+
+    void Media::FinishStreamIndex(StreamIndex& index) {
+        index.keyframes.clear();
+        index.frame_pts.clear();
+
+        for (size_t i = 0; i < index.packets.size(); ++i) {
+            const IndexEntry& packet = index.packets[i];
+
+            // Keyframes without any timestamp can't be searched for
+            if (packet.keyframe && (packet.pts != AV_NOPTS_VALUE || packet.dts != AV_NOPTS_VALUE))
+                index.keyframes.push_back(i);
+
+            // Containers and streams without pts are ordered by dts, which is close enough to pts of the frames
+            if (packet.pts != AV_NOPTS_VALUE)
+                index.frame_pts.push_back(packet.pts);
+            else if (packet.dts != AV_NOPTS_VALUE)
+                index.frame_pts.push_back(packet.dts);
         }
 
-        return Result::Error;
+        std::sort(index.frame_pts.begin(), index.frame_pts.end());
     }
 
-    bool Media::IsVideoOpened() { 
-        return video_opened; 
+    const Media::StreamIndex* Media::GetVideoIndex() {
+        if (index_ready == false || IsVideoOpened() == false || HasAlbumArt())
+            return nullptr;
+
+        if (video_stream_index >= int(stream_indices.size()) || stream_indices[video_stream_index].packets.empty())
+            return nullptr;
+
+        return &stream_indices[video_stream_index];
     }
 
-    double Media::GetAverageVideoFPS() {
-        return av_q2d(av_format_ctx->streams[video_stream_index]->avg_frame_rate); 
+    size_t Media::FindSeekKeyframe(const StreamIndex& index, double time) {
+        if (index.keyframes.empty())
+            return 0;
+
+        // Keyframes are displayed in the same order they are stored. Some containers (AVI, raw streams) only store dts,
+        // which matches pts for keyframes closely enough to pick the right one.
+        auto is_after = [&](double time, size_t keyframe) {
+            const IndexEntry& packet = index.packets[keyframe];
+            int64_t timestamp = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+            return time < VideoTimestampToSeconds(timestamp);
+        };
+
+        auto next = std::upper_bound(index.keyframes.begin(), index.keyframes.end(), time, is_after);
+
+        // If time is before the first keyframe, decoding still has to start from it
+        if (next == index.keyframes.begin())
+            return index.keyframes.front();
+
+        return *(next - 1);
     }
 
-    void Media::PrintVideoInfo() {
-        if (IsVideoOpened() == false) {
-            printf("Video isn't open\n");
-            return;
-        }
+    double Media::VideoTimestampToSeconds(int64_t timestamp) {
+        return double(timestamp * video_time_base.num) / double(video_time_base.den);
+    }
 
-        AVStream* video_stream = av_format_ctx->streams[video_stream_index];
-        double frame_rate = av_q2d(video_stream->avg_frame_rate);
-        int time_base_num = video_stream->time_base.num;
-        int time_base_den = video_stream->time_base.den;
-        int frame_rate_num = video_stream->avg_frame_rate.num;
-        int frame_rate_den = video_stream->avg_frame_rate.den;
+    // av_err2str returns a temporary array. This doesn't work in gcc.
+    // This function can be used as a replacement for av_err2str.
+    const char* Media::GetError(int errnum) {
+        static char str[AV_ERROR_MAX_STRING_SIZE];
+        memset(str, 0, sizeof(str));
+        return av_make_error_string(str, AV_ERROR_MAX_STRING_SIZE, errnum);
+    }
 
-        int64_t duration_origin = av_format_ctx->duration;
-        int64_t duration = duration_origin / AV_TIME_BASE;
-        int64_t duration_h = duration / 3600;
-        int64_t duration_min = (duration % 3600) / 60;
-        int64_t duration_sec = duration % 60;
+    Media::Result Media::ApplySettings() {
+        OLC_MEDIA_ASSERT(settings.preloaded_frames_scale > 0, "\"preloaded_frames_scale\" can't be 0");
+        OLC_MEDIA_ASSERT(settings.video_output_frames > 0, "\"video_output_frames\" can't be 0");
+        OLC_MEDIA_ASSERT(settings.io_buffer_size > 0 && settings.io_buffer_size <= INT32_MAX, "\"io_buffer_size\" must be between 1 and INT32_MAX");
+        OLC_MEDIA_ASSERT(settings.io_uring_reads > 0, "\"io_uring_reads\" can't be 0");
+        OLC_MEDIA_ASSERT(settings.live_read_timeout >= 0.0, "\"live_read_timeout\" can't be negative");
+        OLC_MEDIA_ASSERT(settings.live_probe_size >= 32, "\"live_probe_size\" must be at least 32 bytes");
+        OLC_MEDIA_ASSERT(settings.live_analyze_duration >= 0.0, "\"live_analyze_duration\" can't be negative");
 
-        // Print time base and fps
-        printf("----------------------\n");
-        printf("Video info\n");
-        printf("Codec: %s\n", av_video_codec->long_name);
-        printf("Pixel fmt: %s\n", av_get_pix_fmt_name(av_video_codec_ctx->pix_fmt));
-        printf("Width: %i   Height: %i\n", video_width, video_height);
-        printf("Duration_origin: %lli\n", duration_origin);
-        printf("Duration: %lli:%lli:%lli h:min:sec\n", duration_h, duration_min, duration_sec);
-        printf("Frame rate: %lf\n", frame_rate);
-        printf("Time base num: %i\n", time_base_num);
-        printf("Time base den: %i\n", time_base_den);
-        printf("Frame rate num: %i\n", frame_rate_num);
-        printf("Frame rate den: %i\n", frame_rate_den);
-        printf("Video delay: %i\n", video_delay);
-        printf("----------------------\n");
+        return Result::ResSuccess;
     }
 
-    int Media::GetAudioFrame(void** output, int sample_count) {
-        // Do some error checking
-        if (!output || !(*output) || sample_count < 0)
-            return -1;
+    Media::Result Media::InitVideo() {
+        AVCodecParameters* av_video_codec_params = nullptr;
+
+        video_stream_index = av_find_best_stream(av_format_ctx, AVMEDIA_TYPE_VIDEO, settings.video_stream, -1, (AVCodec**)&av_video_codec, 0);
+        if (video_stream_index < 0) {
+            if (settings.video_stream >= 0) {
+                OLC_MEDIA_ASSERT(false, "Selected video stream doesn't exist, isn't a video stream or has no decoder");
+            }
+            else if (video_stream_index == AVERROR_STREAM_NOT_FOUND) {
+                // TODO: might change it later
+                return Result::ResSuccess;
+            }
+            else if (video_stream_index == AVERROR_DECODER_NOT_FOUND) {
+                OLC_MEDIA_ASSERT(false, "Couldn't find decoder for any of the video streams");
+            }
+            else {
+                OLC_MEDIA_ASSERT(false, "Unknown error occured when trying to find video stream");
+            }
+        }
+
+        av_video_codec_params = av_format_ctx->streams[video_stream_index]->codecpar;
+
+        //av_dump_format(av_format_ctx, video_stream_index, "assets/DWIG - Orange Evening  Laut & Luise (LUL007).mp3", 0);
+        av_dump_format(av_format_ctx, video_stream_index, "assets/face.jpg", 0);
+        //printf("fps: %f\n", av_q2d(av_video_format_ctx->streams[video_stream_index]->avg_frame_rate));
+        //av_video_format_ctx->streams[video_stream_index]->avg_frame_rate;
+
+        OLC_MEDIA_ASSERT(OpenVideoDecoder(0) == Result::ResSuccess, "Couldn't open video decoder");
 
-        // Fill buffer with silence, in case less samples are stored than requested
-        memset(*output, 0, audio_channel_count * audio_sample_size * sample_count);
+        CalculateVideoOutputSize(av_video_codec_params->width, av_video_codec_params->height);
+        OLC_MEDIA_ASSERT(video_width > 0 && video_height > 0, "Invalid video size");
 
-        //printf("as: %i\n", audio_sample_size);
+        // Scaler also upsamples chroma of formats swscale has no fast path for, so it's used even if size doesn't change
+        bool scaled = video_width != av_video_codec_params->width || video_height != av_video_codec_params->height;
+        video_scaler_flags = GetScalerFlags(settings.video_scaler);
 
-        int samples_read = audio_fifo.pop(output, sample_count);
-        conditional.notify_one();
+        // Scaling is done in the same pass as pixel format conversion.
+        // Frames that are already RGB don't need swscale, unless they are scaled.
+        AVPixelFormat source_pix_fmt = Media::CorrectDeprecatedPixelFormat(av_video_codec_ctx->pix_fmt);
+        if (scaled || RgbConverter::IsSupportedFormat(source_pix_fmt) == false) {
+            sws_video_scaler_ctx = sws_getContext(
+                av_video_codec_params->width, av_video_codec_params->height, source_pix_fmt,
+                video_width, video_height, AV_PIX_FMT_RGB0,
+                video_scaler_flags, NULL, NULL, NULL
+            );
+            OLC_MEDIA_ASSERT(sws_video_scaler_ctx != nullptr, "Couldn't initialise SwsContext");
+        }
 
-        // "pop()" can return negative error code so we will convert it to -1
-        if (samples_read < 0)
-            return -1;
-        
-        audio_frames_consumed += samples_read;
+        attached_pic = (av_format_ctx->streams[video_stream_index]->disposition & AV_DISPOSITION_ATTACHED_PIC) ? true : false;
+        converted_video_fifo.init(converted_video_queue_capacity, size_t(video_width) * size_t(video_height));
 
-        // I'm only storing raw audio data, so this is the only way I can calculate audio time stamp without relying on "pts" in the frame
-        audio_time = double(audio_frames_consumed) / double(audio_sample_rate);
+        // Decoded frames are still stored at the source size
+        int frame_bytes = av_image_get_buffer_size(source_pix_fmt, av_video_codec_params->width, av_video_codec_params->height, 1);
+        video_frame_bytes = frame_bytes > 0 ? size_t(frame_bytes) : size_t(av_video_codec_params->width) * size_t(av_video_codec_params->height) * 4;
 
-        //double a_time = audio_time;
-        //printf("at: %lf\n", a_time);
+        // Minimum video fifo capacity must stay 2, regardless of video fps
+        if (HasAlbumArt()) {
+            video_fifo.init(2, 0, 1);
+        }
+        else {
+            // Decoder is woken up once half of the frames were consumed, so that it decodes frames in bursts
+            size_t capacity = CalculateVideoQueueCapacity();
+            Result result = video_fifo.init(uint16_t(capacity), capacity / 2, 1);
+            OLC_MEDIA_ASSERT(result == Result::ResSuccess, "Couldn't allocate video fifo");
+        }
 
-        //printf("sr: %i\n", samples_read);
 
-        //printf("tot: %llu\n", audio_frames_consumed);
-        //printf("-----------\n");
+        av_video_packet = av_packet_alloc();
+        OLC_MEDIA_ASSERT(av_video_packet != nullptr, "Couldn't allocate AVPacket");
 
-        // TEMP
-        //memset(*output, 0, audio_channel_count * audio_sample_size * sample_count);
+        video_opened = true;
+        // Converter threads only wait for frames, so they can be started before the pipeline
+        size_t converter_thread_count = settings.video_converter_thread_count;
+        if (converter_thread_count == 0)
+            converter_thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+        video_converter_workers.start(converter_thread_count);
+
+        // Decals returned before stay valid, only their contents change
+        video_frames.resize(settings.video_output_frames);
+        for (olc::Renderable& frame : video_frames)
+            frame.Create(video_width, video_height);
+        current_video_frame = 0;
+        video_time_base = av_format_ctx->streams[video_stream_index]->time_base;
+        video_delay = av_video_codec_params->video_delay;
 
-        return samples_read;
+        // Reset values if video was previously opened
+        delta_time_accumulator = 0.0f;
+        last_video_pts = 0.0;
+        video_preroll_quality = false;
+        video_keyframes_only = false;
+        video_supports_lowres = av_video_codec->max_lowres > 0;
+        video_decode_quality = VideoDecodeQuality::Full;
+        video_lateness_state = 0;
+
+        PrintVideoInfo();
+
+        return Result::ResSuccess;
     }
 
-    bool Media::IsAudioOpened() {
-        return audio_opened; 
+    void Media::CalculateVideoOutputSize(int source_width, int source_height) {
+        double scale = 1.0;
+        if (settings.video_output_width > 0)
+            scale = std::min(scale, double(settings.video_output_width) / double(source_width));
+        if (settings.video_output_height > 0)
+            scale = std::min(scale, double(settings.video_output_height) / double(source_height));
+
+        video_width = std::max(1, int(std::lround(source_width * scale)));
+        video_height = std::max(1, int(std::lround(source_height * scale)));
     }
 
-    void Media::PrintAudioInfo() {
-        if (IsAudioOpened() == false) {
-            printf("Audio isn't open\n");
-            return;
+    int Media::GetScalerFlags(VideoScaler scaler) {
+        switch (scaler) {
+        case VideoScaler::Point:        return SWS_POINT;
+        case VideoScaler::FastBilinear: return SWS_FAST_BILINEAR;
+        case VideoScaler::Bicubic:      return SWS_BICUBIC;
+        default:                        return SWS_BILINEAR;
         }
-        //av_dump_format(av_format_ctx, )
-        //printf("stream count: %u\n", av_format_ctx->nb_streams);
+    }
 
-        AVStream* audio_stream = av_format_ctx->streams[audio_stream_index];
-        int frame_size = av_format_ctx->streams[audio_stream_index]->codecpar->frame_size;
-        int sample_rate = av_format_ctx->streams[audio_stream_index]->codecpar->sample_rate;
-        int channels = av_format_ctx->streams[audio_stream_index]->codecpar->channels;
-        int time_base_num = audio_stream->time_base.num;
-        int time_base_den = audio_stream->time_base.den;
-        int pkt_time_base_num = av_audio_codec_ctx->pkt_timebase.num;
-        int pkt_time_base_den = av_audio_codec_ctx->pkt_timebase.den;
-        int ctx_sample_rate = av_audio_codec_ctx->sample_rate;
+    void Media::CloseVideo() {
+        avcodec_free_context(&av_video_codec_ctx);
+        av_packet_free(&av_video_packet);
+        sws_freeContext(sws_video_scaler_ctx);
+        sws_video_scaler_ctx = nullptr;
+        video_converter_workers.stop();
+        FreeBandScalers();
+        av_frame_free(&temp_video_frame);
 
-        int64_t duration_origin = av_format_ctx->duration;
-        int64_t duration = duration_origin / AV_TIME_BASE;
-        int64_t duration_h = duration / 3600;
-        int64_t duration_min = (duration % 3600) / 60;
-        int64_t duration_sec = duration % 60;
+        attached_pic = false;
+        video_opened = false;
+        video_width = 0;
+        video_height = 0;
+        video_fifo.clear();
+        video_fifo.free();
+        converted_video_fifo.free();
 
-        // Print time base and fps
-        printf("----------------------\n");
-        printf("Audio info\n");
+        // Doesn't fully clear memory, but better than nothing
+        for (olc::Renderable& frame : video_frames)
+            frame.Create(0, 0);
+    }
 
-        printf("Codec: %s\n", av_audio_codec->long_name);
-        printf("Frame size: %i\n", frame_size);
-        printf("Original format type: %s\n", av_get_sample_fmt_name(GetAudioOriginalFormat()));
-        printf("Output format type: %s\n", av_get_sample_fmt_name(GetAudioOutputFormat()));
-        printf("Duration_origin: %lli\n", duration_origin);
-        printf("Duration: %lli:%lli:%lli h:min:sec\n", duration_h, duration_min, duration_sec);
-        printf("Sample rate: %i\n", sample_rate);
-        printf("Channels: %i\n", channels);
-        printf("Time base num: %i\n", time_base_num);
-        printf("Time base den: %i\n", time_base_den);
-        printf("Packet time base num: %i\n", pkt_time_base_num);
-        printf("Packet time base den: %i\n", pkt_time_base_den);
-        printf("Ctx sample rate: %i\n", ctx_sample_rate);
-        printf("block_align: %i\n", av_format_ctx->streams[audio_stream_index]->codecpar->block_align);
-        printf("initial_padding: %i\n", av_format_ctx->streams[audio_stream_index]->codecpar->initial_padding);
-        printf("trailing_padding: %i\n", av_format_ctx->streams[audio_stream_index]->codecpar->trailing_padding);
-        printf("seek_preroll: %i\n", av_format_ctx->streams[audio_stream_index]->codecpar->seek_preroll);
-        printf("----------------------\n");
+    bool Media::YuvConverter::CanConvert(const AVFrame* frame, int target_width, int target_height) {
+        AVPixelFormat format = (AVPixelFormat)frame->format;
+        if (format != AV_PIX_FMT_YUV420P && format != AV_PIX_FMT_YUVJ420P && format != AV_PIX_FMT_NV12)
+            return false;
+
+        // Scaling is left to swscale
+        return frame->width == target_width && frame->height == target_height;
     }
 
-    void Media::SetAudioVolume(float new_volume) {
-        if (IsAudioOpened() == false)
-            return;
+    void Media::YuvConverter::ConvertRows(const AVFrame* frame, olc::Pixel* target, int row_begin, int row_end) {
+        bool interleaved = frame->format == AV_PIX_FMT_NV12;
 
-        // Clamp volume
-        if (new_volume < 0.0f)
-            new_volume = 0.0f;
-        else if (new_volume > 1.0f)
-            new_volume = 1.0f;
+        const Kernels& kernels = GetKernels();
+        RowFunction convert_row = interleaved ? kernels.interleaved : kernels.planar;
+        Coefficients c = GetCoefficients(frame);
 
-        audio_volume = new_volume;
-        ma_device_set_master_volume(&audio_device, audio_volume);
+        // Every chroma row is shared by 2 luma rows
+        for (int row = row_begin; row < row_end; row++) {
+            const uint8_t* y = frame->data[0] + ptrdiff_t(row) * frame->linesize[0];
+            const uint8_t* u = frame->data[1] + ptrdiff_t(row / 2) * frame->linesize[1];
+            const uint8_t* v = interleaved ? nullptr : frame->data[2] + ptrdiff_t(row / 2) * frame->linesize[2];
+
+            convert_row(y, u, v, target + ptrdiff_t(row) * frame->width, frame->width, c);
+        }
     }
 
-    float Media::GetAudioVolume() {
-        if (IsAudioOpened() == false)
-            return 0.0;
+    const char* Media::YuvConverter::GetInstructionSet() {
+        return GetKernels().instruction_set;
+    }
 
-        return audio_volume;
+    const Media::YuvConverter::Kernels& Media::YuvConverter::GetKernels() {
+        static const Kernels kernels = SelectKernels();
+        return kernels;
     }
 
-    AVSampleFormat Media::GetAudioOutputFormat() {
-        assert(IsAudioOpened());
+    Media::YuvConverter::Kernels Media::YuvConverter::SelectKernels() {
+#if defined(OLC_MEDIA_X86)
+        if (CpuFeatures::Get().avx2)
+            return { "AVX2", ConvertRowAVX2<false>, ConvertRowAVX2<true> };
+        if (CpuFeatures::Get().sse41)
+            return { "SSE4.1", ConvertRowSSE41<false>, ConvertRowSSE41<true> };
+#elif defined(OLC_MEDIA_NEON)
+        return { "NEON", ConvertRowNEON<false>, ConvertRowNEON<true> };
+#endif
 
-        return audio_format;
+        return { "None", ConvertRowScalar<false>, ConvertRowScalar<true> };
     }
 
-    AVSampleFormat Media::GetAudioOriginalFormat() {
-        assert(IsAudioOpened());
+    Media::YuvConverter::Coefficients Media::YuvConverter::GetCoefficients(const AVFrame* frame) {
+        bool full_range = frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P;
 
-        return (AVSampleFormat)av_format_ctx->streams[audio_stream_index]->codecpar->format;
-    }
+        // Like swscale, BT.601 is used when color space isn't specified
+        bool bt709 = frame->colorspace == AVCOL_SPC_BT709;
 
-    int Media::GetAudioSampleSize() {
-        assert(IsAudioOpened());
+        // Coefficients are multiplied by 64
+        if (bt709)
+            return full_range ? Coefficients{ 0, 64, 101, 12, 30, 119 } : Coefficients{ 16, 75, 115, 14, 34, 135 };
 
-        return audio_sample_size;
+        return full_range ? Coefficients{ 0, 64, 90, 22, 46, 113 } : Coefficients{ 16, 75, 102, 25, 52, 129 };
     }
 
-    int Media::GetAudioSampleRate() {
-        assert(IsAudioOpened());
+    template<bool interleaved>
+    void Media::YuvConverter::ConvertPixels(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int begin, int end, const Coefficients& c) {
+        auto clamp = [](int value) { return uint8_t(std::min(std::max(value >> 6, 0), 255)); };
 
-        return audio_sample_rate;
-    }
+        for (int x = begin; x < end; x++) {
+            int chroma = x / 2;
+            int u_value = (interleaved ? u[chroma * 2] : u[chroma]) - 128;
+            int v_value = (interleaved ? u[chroma * 2 + 1] : v[chroma]) - 128;
 
-    int Media::GetAudioChannelCount() {
-        assert(IsAudioOpened());
+            // Rounding is added to luma, so that it's done once for all 3 channels
+            int luma = (y[x] - c.y_offset) * c.y + 32;
 
-        return audio_channel_count;
+            dest[x] = olc::Pixel(
+                clamp(luma + c.r_v * v_value),
+                clamp(luma - (c.g_u * u_value + c.g_v * v_value)),
+                clamp(luma + c.b_u * u_value),
+                255
+            );
+        }
     }
 
-    bool Media::HasAlbumArt() {
-        return attached_pic;
+    template<bool interleaved>
+    void Media::YuvConverter::ConvertRowScalar(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int width, const Coefficients& c) {
+        ConvertPixels<interleaved>(y, u, v, dest, 0, width, c);
     }
 
-    Media::Result Media::Open(const FileName& filename, bool open_video, bool open_audio, Settings* playback_settings) {
-        Result result;
+#ifdef OLC_MEDIA_X86
+    const Media::CpuFeatures& Media::CpuFeatures::Get() {
+        static const CpuFeatures features = Detect();
+        return features;
+    }
 
-        if (playback_settings != nullptr)
-            settings = *playback_settings;
+    Media::CpuFeatures Media::CpuFeatures::Detect() {
+        CpuFeatures features;
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        int max_function = info[0];
 
-        result = ApplySettings();
-        if (result != Result::ResSuccess)
-            return result;
+        __cpuid(info, 1);
+        features.sse41 = (info[2] & (1 << 19)) != 0;
+        bool os_saves_avx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
 
-        // If media is already open, close it first
-        if (IsVideoOpened() || IsAudioOpened()) {
-            Close();
+        if (max_function >= 7 && os_saves_avx) {
+            __cpuidex(info, 7, 0);
+            features.avx2 = (info[1] & (1 << 5)) != 0;
         }
+#else
+        __builtin_cpu_init();
+        features.sse41 = __builtin_cpu_supports("sse4.1") != 0;
+        features.avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif // _MSC_VER
+        return features;
+    }
 
-        result = OpenFile(filename);
-        if (result != Result::ResSuccess)
-            return result;
+    template<bool interleaved>
+    OLC_MEDIA_TARGET("sse4.1") void Media::YuvConverter::ConvertRowSSE41(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int width, const Coefficients& c) {
+        const __m128i y_offset = _mm_set1_epi16(c.y_offset);
+        const __m128i y_coefficient = _mm_set1_epi16(c.y);
+        const __m128i r_v = _mm_set1_epi16(c.r_v);
+        const __m128i g_u = _mm_set1_epi16(c.g_u);
+        const __m128i g_v = _mm_set1_epi16(c.g_v);
+        const __m128i b_u = _mm_set1_epi16(c.b_u);
+        const __m128i chroma_offset = _mm_set1_epi16(128);
+        const __m128i rounding = _mm_set1_epi16(32);
+        const __m128i alpha = _mm_set1_epi8(-1);
+        // Moves U values to the low half and V values to the high half
+        const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+
+        // 16 pixels (8 chroma samples) per iteration
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i u8, v8;
+            if (interleaved) {
+                __m128i uv = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(u + x)), deinterleave);
+                u8 = uv;
+                v8 = _mm_srli_si128(uv, 8);
+            }
+            else {
+                u8 = _mm_loadl_epi64((const __m128i*)(u + x / 2));
+                v8 = _mm_loadl_epi64((const __m128i*)(v + x / 2));
+            }
 
-        // Opened video won't be paused, even if the previous video was paused, to avoid possible confusion
-        is_paused = false;
+            __m128i u16 = _mm_sub_epi16(_mm_cvtepu8_epi16(u8), chroma_offset);
+            __m128i v16 = _mm_sub_epi16(_mm_cvtepu8_epi16(v8), chroma_offset);
+            __m128i r_chroma = _mm_mullo_epi16(v16, r_v);
+            __m128i g_chroma = _mm_add_epi16(_mm_mullo_epi16(u16, g_u), _mm_mullo_epi16(v16, g_v));
+            __m128i b_chroma = _mm_mullo_epi16(u16, b_u);
+
+            __m128i luma = _mm_loadu_si128((const __m128i*)(y + x));
+            __m128i r[2], g[2], b[2];
+            for (int half = 0; half < 2; half++) {
+                __m128i y16 = _mm_cvtepu8_epi16(half == 0 ? luma : _mm_srli_si128(luma, 8));
+                y16 = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y16, y_offset), y_coefficient), rounding);
+
+                // Every chroma sample covers 2 pixels
+                __m128i r_pixels = half == 0 ? _mm_unpacklo_epi16(r_chroma, r_chroma) : _mm_unpackhi_epi16(r_chroma, r_chroma);
+                __m128i g_pixels = half == 0 ? _mm_unpacklo_epi16(g_chroma, g_chroma) : _mm_unpackhi_epi16(g_chroma, g_chroma);
+                __m128i b_pixels = half == 0 ? _mm_unpacklo_epi16(b_chroma, b_chroma) : _mm_unpackhi_epi16(b_chroma, b_chroma);
+
+                // Saturation only happens when the result is out of range anyway, so it's clamped the same way as without it
+                r[half] = _mm_srai_epi16(_mm_adds_epi16(y16, r_pixels), 6);
+                g[half] = _mm_srai_epi16(_mm_subs_epi16(y16, g_pixels), 6);
+                b[half] = _mm_srai_epi16(_mm_adds_epi16(y16, b_pixels), 6);
+            }
 
-        if (open_video) {
-            result = InitVideo();
-            if (result != Result::ResSuccess)
-                return result;
+            __m128i r8 = _mm_packus_epi16(r[0], r[1]);
+            __m128i g8 = _mm_packus_epi16(g[0], g[1]);
+            __m128i b8 = _mm_packus_epi16(b[0], b[1]);
+
+            __m128i rg_low = _mm_unpacklo_epi8(r8, g8);
+            __m128i rg_high = _mm_unpackhi_epi8(r8, g8);
+            __m128i ba_low = _mm_unpacklo_epi8(b8, alpha);
+            __m128i ba_high = _mm_unpackhi_epi8(b8, alpha);
+
+            __m128i* out = (__m128i*)(dest + x);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(rg_low, ba_low));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rg_low, ba_low));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rg_high, ba_high));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rg_high, ba_high));
         }
 
-        if (open_audio) {
-            result = InitAudio();
-            if (result != Result::ResSuccess) {
-                return result;
+        ConvertPixels<interleaved>(y, u, v, dest, x, width, c);
+    }
+
+    template<bool interleaved>
+    OLC_MEDIA_TARGET("avx2") void Media::YuvConverter::ConvertRowAVX2(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int width, const Coefficients& c) {
+        const __m256i y_offset = _mm256_set1_epi16(c.y_offset);
+        const __m256i y_coefficient = _mm256_set1_epi16(c.y);
+        const __m256i r_v = _mm256_set1_epi16(c.r_v);
+        const __m256i g_u = _mm256_set1_epi16(c.g_u);
+        const __m256i g_v = _mm256_set1_epi16(c.g_v);
+        const __m256i b_u = _mm256_set1_epi16(c.b_u);
+        const __m256i chroma_offset = _mm256_set1_epi16(128);
+        const __m256i rounding = _mm256_set1_epi16(32);
+        const __m256i alpha = _mm256_set1_epi16(255);
+        const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+
+        // 16 pixels per iteration, each in its own 16 bit lane
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i u8, v8;
+            if (interleaved) {
+                __m128i uv = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(u + x)), deinterleave);
+                u8 = uv;
+                v8 = _mm_srli_si128(uv, 8);
+            }
+            else {
+                u8 = _mm_loadl_epi64((const __m128i*)(u + x / 2));
+                v8 = _mm_loadl_epi64((const __m128i*)(v + x / 2));
             }
-        }
 
-        StartDecodingThread();
+            // Every chroma sample covers 2 pixels, so they are duplicated before widening
+            __m256i u16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u8, u8)), chroma_offset);
+            __m256i v16 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v8, v8)), chroma_offset);
 
-        return Result::ResSuccess;
-    }
+            __m256i y16 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + x)));
+            y16 = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y16, y_offset), y_coefficient), rounding);
 
-    Media::Result Media::OpenFile(const FileName& filename) {
-        int response;
+            __m256i g_chroma = _mm256_add_epi16(_mm256_mullo_epi16(u16, g_u), _mm256_mullo_epi16(v16, g_v));
+            __m256i r = _mm256_srai_epi16(_mm256_adds_epi16(y16, _mm256_mullo_epi16(v16, r_v)), 6);
+            __m256i g = _mm256_srai_epi16(_mm256_subs_epi16(y16, g_chroma), 6);
+            __m256i b = _mm256_srai_epi16(_mm256_adds_epi16(y16, _mm256_mullo_epi16(u16, b_u)), 6);
 
-        av_format_ctx = avformat_alloc_context();
-        OLC_MEDIA_ASSERT(av_format_ctx != nullptr, "Couldn't allocate AVFormatContext");
+            // AVX2 packs and unpacks within 128 bit lanes, so pixels 0-7 end up in the low lane and 8-15 in the high lane
+            __m256i rg = _mm256_packus_epi16(r, g);     // R0-7 G0-7 | R8-15 G8-15
+            __m256i ba = _mm256_packus_epi16(b, alpha); // B0-7 A0-7 | B8-15 A8-15
+            rg = _mm256_unpacklo_epi8(rg, _mm256_srli_si256(rg, 8));
+            ba = _mm256_unpacklo_epi8(ba, _mm256_srli_si256(ba, 8));
 
-        OLC_MEDIA_ASSERT(ioCtx.initAVFmtCtx(filename, av_format_ctx) == true, "Couldn't initialize AVFormatContext: most likely couldn't find/open file");
+            __m256i low = _mm256_unpacklo_epi16(rg, ba);  // Pixels 0-3 | 8-11
+            __m256i high = _mm256_unpackhi_epi16(rg, ba); // Pixels 4-7 | 12-15
 
-        response = avformat_open_input(&av_format_ctx, "", NULL, NULL);
-        if (response < 0) {
-            printf("avformat_open_input response: %s\n", GetError(response));
+            __m256i* out = (__m256i*)(dest + x);
+            _mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(low, high, 0x20));
+            _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(low, high, 0x31));
         }
-        OLC_MEDIA_ASSERT(response == 0, "Couldn't open file: most likely format isn't supported");
-
-        response = avformat_find_stream_info(av_format_ctx, nullptr);
-        OLC_MEDIA_ASSERT(response >= 0, "Couldn't find stream info");
 
-        return Result::ResSuccess;
+        ConvertPixels<interleaved>(y, u, v, dest, x, width, c);
     }
+#endif // OLC_MEDIA_X86
+
+#ifdef OLC_MEDIA_NEON
+    template<bool interleaved>
+    void Media::YuvConverter::ConvertRowNEON(const uint8_t* y, const uint8_t* u, const uint8_t* v, olc::Pixel* dest, int width, const Coefficients& c) {
+        const int16x8_t y_offset = vdupq_n_s16(c.y_offset);
+        const int16x8_t rounding = vdupq_n_s16(32);
+        const uint8x8_t chroma_offset = vdup_n_u8(128);
+
+        // 16 pixels (8 chroma samples) per iteration
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint8x8_t u8, v8;
+            if (interleaved) {
+                uint8x8x2_t uv = vld2_u8(u + x);
+                u8 = uv.val[0];
+                v8 = uv.val[1];
+            }
+            else {
+                u8 = vld1_u8(u + x / 2);
+                v8 = vld1_u8(v + x / 2);
+            }
 
-    void Media::CloseFile() {
-        avformat_close_input(&av_format_ctx);
+            // Wrapping subtraction gives the right signed value once it's reinterpreted
+            int16x8_t u16 = vreinterpretq_s16_u16(vsubl_u8(u8, chroma_offset));
+            int16x8_t v16 = vreinterpretq_s16_u16(vsubl_u8(v8, chroma_offset));
+
+            // Every chroma sample covers 2 pixels
+            int16x8x2_t r_chroma = vzipq_s16(vmulq_n_s16(v16, c.r_v), vmulq_n_s16(v16, c.r_v));
+            int16x8_t g_product = vmlaq_n_s16(vmulq_n_s16(u16, c.g_u), v16, c.g_v);
+            int16x8x2_t g_chroma = vzipq_s16(g_product, g_product);
+            int16x8x2_t b_chroma = vzipq_s16(vmulq_n_s16(u16, c.b_u), vmulq_n_s16(u16, c.b_u));
+
+            uint8x16_t luma = vld1q_u8(y + x);
+            uint8x8_t r[2], g[2], b[2];
+            for (int half = 0; half < 2; half++) {
+                int16x8_t y16 = vreinterpretq_s16_u16(vmovl_u8(half == 0 ? vget_low_u8(luma) : vget_high_u8(luma)));
+                y16 = vaddq_s16(vmulq_n_s16(vsubq_s16(y16, y_offset), c.y), rounding);
+
+                r[half] = vqshrun_n_s16(vqaddq_s16(y16, r_chroma.val[half]), 6);
+                g[half] = vqshrun_n_s16(vqsubq_s16(y16, g_chroma.val[half]), 6);
+                b[half] = vqshrun_n_s16(vqaddq_s16(y16, b_chroma.val[half]), 6);
+            }
 
-        // Don't think this function is really needed, but I put it here for sanity reasons
-        avformat_free_context(av_format_ctx);
+            uint8x16x4_t rgba;
+            rgba.val[0] = vcombine_u8(r[0], r[1]);
+            rgba.val[1] = vcombine_u8(g[0], g[1]);
+            rgba.val[2] = vcombine_u8(b[0], b[1]);
+            rgba.val[3] = vdupq_n_u8(255);
+            vst4q_u8((uint8_t*)(dest + x), rgba);
+        }
 
-        ioCtx.closeIO();
+        ConvertPixels<interleaved>(y, u, v, dest, x, width, c);
     }
+#endif // OLC_MEDIA_NEON
 
-    void Media::StartDecodingThread() {
-        printf("Starting thread\n");
-        keep_loading = true;
-        finished_reading = false;
-        this->frame_loader = std::thread(&Media::DecodingThread, this);
+    bool Media::RgbConverter::IsSupportedFormat(AVPixelFormat format) {
+        return GetLayout(format).bytes_per_pixel != 0;
     }
 
-    void Media::StopDecodingThread() {
-        keep_loading = false;
-        finished_reading = true;
-        conditional.notify_one();
-        if (frame_loader.joinable()) {
-            frame_loader.join();
-        }
+    bool Media::RgbConverter::CanConvert(const AVFrame* frame, int target_width, int target_height) {
+        if (IsSupportedFormat((AVPixelFormat)frame->format) == false)
+            return false;
+
+        // Scaling is left to swscale
+        return frame->width == target_width && frame->height == target_height;
     }
 
-    Media::Result Media::DecodingThread() {
-        finished_reading = false;
+    void Media::RgbConverter::ConvertRows(const AVFrame* frame, olc::Pixel* target, int row_begin, int row_end) {
+        Layout layout = GetLayout((AVPixelFormat)frame->format);
+        size_t row_bytes = size_t(frame->width) * sizeof(olc::Pixel);
 
-        std::unique_lock<std::mutex> lock(mutex);
+        // RGBA is the same as "olc::Pixel" layout, so it's copied as is
+        if (layout.bytes_per_pixel == 4 && layout.r == 0 && layout.g == 1 && layout.b == 2 && layout.a == 3) {
+            for (int row = row_begin; row < row_end; row++)
+                memcpy(target + ptrdiff_t(row) * frame->width, frame->data[0] + ptrdiff_t(row) * frame->linesize[0], row_bytes);
 
-        // TODO: figure out if I should add limit for audio queue size
+            return;
+        }
 
-        // Maximum amount of frames that can be pre-decoded
-        size_t max_video_queue_size;
+        RowFunction convert_row = GetRowFunction();
+        for (int row = row_begin; row < row_end; row++)
+            convert_row(frame->data[0] + ptrdiff_t(row) * frame->linesize[0], target + ptrdiff_t(row) * frame->width, frame->width, layout);
+    }
 
-        // Minimum amount of frames that should be pre-decoded
-        size_t min_video_queue_size;
-        size_t min_audio_queue_size;
+    Media::RgbConverter::Layout Media::RgbConverter::GetLayout(AVPixelFormat format) {
+        switch (format) {
+        case AV_PIX_FMT_RGBA:  return { 4, 0, 1, 2, 3 };
+        case AV_PIX_FMT_BGRA:  return { 4, 2, 1, 0, 3 };
+        case AV_PIX_FMT_ARGB:  return { 4, 1, 2, 3, 0 };
+        case AV_PIX_FMT_ABGR:  return { 4, 3, 2, 1, 0 };
+        case AV_PIX_FMT_RGB0:  return { 4, 0, 1, 2, -1 };
+        case AV_PIX_FMT_BGR0:  return { 4, 2, 1, 0, -1 };
+        case AV_PIX_FMT_0RGB:  return { 4, 1, 2, 3, -1 };
+        case AV_PIX_FMT_0BGR:  return { 4, 3, 2, 1, -1 };
+        case AV_PIX_FMT_RGB24: return { 3, 0, 1, 2, -1 };
+        case AV_PIX_FMT_BGR24: return { 3, 2, 1, 0, -1 };
+        default:               return {};
+        }
+    }
 
-        if (IsVideoOpened()) {
-            if (HasAlbumArt()) {
-                max_video_queue_size = 1;
-                min_video_queue_size = 1;
-            }
-            else {
-                // "-1" because resizing is disabled, and it allows to avoid overwriting a frame recevied from "GetVideoFrame()"
-                max_video_queue_size = video_fifo.capacity() - 1;
-                min_video_queue_size = std::max(max_video_queue_size / 2, size_t(1));
-            }
+    Media::RgbConverter::RowFunction Media::RgbConverter::GetRowFunction() {
+#if defined(OLC_MEDIA_X86)
+        if (CpuFeatures::Get().sse41)
+            return ConvertRowSSSE3;
+#elif defined(OLC_MEDIA_NEON)
+        return ConvertRowNEON;
+#endif
+
+        return ConvertRowScalar;
+    }
 
-            //printf("max_v: %llu\n", max_video_queue_size);
-            //printf("min_v: %llu\n", min_video_queue_size);
+    void Media::RgbConverter::ConvertPixels(const uint8_t* source, olc::Pixel* dest, int begin, int end, const Layout& layout) {
+        for (int x = begin; x < end; x++) {
+            const uint8_t* pixel = source + ptrdiff_t(x) * layout.bytes_per_pixel;
+            dest[x] = olc::Pixel(pixel[layout.r], pixel[layout.g], pixel[layout.b], layout.a >= 0 ? pixel[layout.a] : 255);
         }
+    }
 
-        if (IsAudioOpened()) {
-            min_audio_queue_size = std::max(size_t(audio_fifo.capacity() / 2), size_t(1));
+    void Media::RgbConverter::ConvertRowScalar(const uint8_t* source, olc::Pixel* dest, int width, const Layout& layout) {
+        ConvertPixels(source, dest, 0, width, layout);
+    }
 
-            //printf("min_a: %llu\n", min_audio_queue_size);
+#ifdef OLC_MEDIA_X86
+    OLC_MEDIA_TARGET("ssse3") void Media::RgbConverter::ConvertRowSSSE3(const uint8_t* source, olc::Pixel* dest, int width, const Layout& layout) {
+        // Shuffle mask that moves 4 source pixels into RGBA order. Missing alpha is zeroed by the shuffle (index with
+        // the highest bit set), and then set to 255.
+        alignas(16) int8_t mask[16];
+        for (int i = 0; i < 4; i++) {
+            int offset = i * layout.bytes_per_pixel;
+            mask[i * 4 + 0] = int8_t(offset + layout.r);
+            mask[i * 4 + 1] = int8_t(offset + layout.g);
+            mask[i * 4 + 2] = int8_t(offset + layout.b);
+            mask[i * 4 + 3] = layout.a >= 0 ? int8_t(offset + layout.a) : int8_t(-1);
         }
 
-        int response;
-
-        AVFrame* av_audio_frame = av_frame_alloc();
-        OLC_MEDIA_ASSERT(av_audio_frame != nullptr, "Couldn't allocate resampled AVFrame");
+        const __m128i shuffle = _mm_load_si128((const __m128i*)mask);
+        const __m128i alpha = layout.a >= 0 ? _mm_setzero_si128() : _mm_set1_epi32(int(0xFF000000));
 
-        // Used to store converted "av_audio_frame"
-        AVFrame* resampled_audio_frame = av_frame_alloc();
-        OLC_MEDIA_ASSERT(resampled_audio_frame != nullptr, "Couldn't allocate resampled AVFrame");
+        // 4 pixels per iteration. Every load reads 16 bytes, which is more than 4 pixels of 3 byte formats,
+        // so the loop stops early enough to not read past the end of the row.
+        int x = 0;
+        for (; x * layout.bytes_per_pixel + 16 <= width * layout.bytes_per_pixel; x += 4) {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(source + ptrdiff_t(x) * layout.bytes_per_pixel));
+            _mm_storeu_si128((__m128i*)(dest + x), _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha));
+        }
 
-        AVPacket* av_packet = av_packet_alloc();
-        OLC_MEDIA_ASSERT(av_packet != nullptr, "Couldn't allocate resampled AVFrame");
+        ConvertPixels(source, dest, x, width, layout);
+    }
+#endif // OLC_MEDIA_X86
+
+#ifdef OLC_MEDIA_NEON
+    void Media::RgbConverter::ConvertRowNEON(const uint8_t* source, olc::Pixel* dest, int width, const Layout& layout) {
+        // 16 pixels per iteration. Loads split pixels into separate channel registers, so channels are
+        // only reordered when they are stored.
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            const uint8_t* pixels = source + ptrdiff_t(x) * layout.bytes_per_pixel;
+            uint8x16_t channels[4];
+
+            if (layout.bytes_per_pixel == 4) {
+                uint8x16x4_t loaded = vld4q_u8(pixels);
+                for (int i = 0; i < 4; i++)
+                    channels[i] = loaded.val[i];
+            }
+            else {
+                uint8x16x3_t loaded = vld3q_u8(pixels);
+                for (int i = 0; i < 3; i++)
+                    channels[i] = loaded.val[i];
+                channels[3] = vdupq_n_u8(255);
+            }
 
-        while (true) {
-            while (true) {
-                if (!HasAlbumArt() && IsVideoOpened() && video_fifo.size() <= min_video_queue_size) {
-                    //printf("vb\n");
-                    break;
-                }
-                
-                if (IsAudioOpened() && audio_fifo.size() <= min_audio_queue_size) {
-                    
-                    break;
-                }
+            uint8x16x4_t rgba;
+            rgba.val[0] = channels[layout.r];
+            rgba.val[1] = channels[layout.g];
+            rgba.val[2] = channels[layout.b];
+            rgba.val[3] = layout.a >= 0 ? channels[layout.a] : vdupq_n_u8(255);
+            vst4q_u8((uint8_t*)(dest + x), rgba);
+        }
 
+        ConvertPixels(source, dest, x, width, layout);
+    }
+#endif // OLC_MEDIA_NEON
 
+    void Media::BandWorkers::start(size_t thread_count) {
+        stop();
 
-                if (keep_loading == false)
-                    break;
+        _stopping = false;
+        for (size_t i = 1; i < thread_count; i++)
+            _threads.emplace_back(&BandWorkers::worker_thread, this);
+    }
 
-                conditional.wait(lock);
-            }
+    void Media::BandWorkers::stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _job_available.notify_all();
 
-            if (keep_loading == false)
-                break;
+        for (std::thread& thread : _threads)
+            thread.join();
 
+        _threads.clear();
+    }
 
-            /*// Get remaining audio from previous conversion
-            if (IsAudioOpened()) {
-                if (swr_get_delay(swr_audio_resampler, std::max(resampled_audio_frame->sample_rate, av_audio_frame->sample_rate)) > 0) {
-                    response = swr_convert_frame(swr_audio_resampler, resampled_audio_frame, nullptr);
-                    OLC_MEDIA_ASSERT(response == 0, "Couldn't resample the frame");
+    size_t Media::BandWorkers::thread_count() const {
+        return _threads.size() + 1;
+    }
 
-                    int samples_written = audio_fifo.push((void**)resampled_audio_frame->data, resampled_audio_frame->nb_samples);
+    void Media::BandWorkers::run(size_t band_count, const std::function<void(size_t)>& job) {
+        if (_threads.empty() || band_count <= 1) {
+            for (size_t band = 0; band < band_count; band++)
+                job(band);
+            return;
+        }
 
-                    //printf("afd\n");
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _job = &job;
+            _band_count = band_count;
+            _finished_bands = 0;
+            _next_band = 0;
+            _generation++;
+        }
+        _job_available.notify_all();
 
-                    continue;
-                }
-            }*/
+        size_t finished = run_bands(job, band_count);
 
-            // Try reading next packet
-            response = av_read_frame(av_format_ctx, av_packet);
+        // Job must stay alive until none of the threads can touch it anymore
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finished_bands += finished;
+        _job_done.wait(lock, [&] { return _finished_bands == _band_count && _busy_threads == 0; });
+        _job = nullptr;
+    }
 
-            // Return if error or end of file was encountered
-            if (response < 0) {
-                printf("Error or end of file happened\n");
-                printf("Exit info: %s\n", GetError(response));
+    void Media::BandWorkers::worker_thread() {
+        uint64_t generation = 0;
 
-                // TODO: check if response is error or end of file
-                break;
+        while (true) {
+            const std::function<void(size_t)>* job;
+            size_t band_count;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _job_available.wait(lock, [&] { return _stopping || (_job != nullptr && _generation != generation); });
+                if (_stopping)
+                    return;
+
+                generation = _generation;
+                job = _job;
+                band_count = _band_count;
+                _busy_threads++;
             }
 
-            if (IsVideoOpened() && av_packet->stream_index == video_stream_index) {
-                //printf("vp\n");
-                //Piratimer::start("DecodeVideoFrame");
+            size_t finished = run_bands(*job, band_count);
 
-                // Drain a frame when max size is reached
-                if (max_video_queue_size == video_fifo.size()) {
-                    video_fifo.pop();
-                }
-                    
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _finished_bands += finished;
+                _busy_threads--;
+            }
+            _job_done.notify_one();
+        }
+    }
+
+    size_t Media::BandWorkers::run_bands(const std::function<void(size_t)>& job, size_t band_count) {
+        size_t finished = 0;
+        for (size_t band = _next_band++; band < band_count; band = _next_band++) {
+            job(band);
+            finished++;
+        }
 
-                AVFrame* av_video_frame = video_fifo.back();
+        return finished;
+    }
 
-                // Send packet to decode
-                response = avcodec_send_packet(av_video_codec_ctx, av_packet);
-                OLC_MEDIA_ASSERT(response == 0, "Couldn't decode packet");
+    void Media::ConvertFrameToRGBA(AVFrame* frame, olc::Pixel* target) {
+        // TODO: implement some error checking
 
-                // Receive decoded frame
-                response = avcodec_receive_frame(av_video_codec_ctx, av_video_frame);
-                if (response < 0) {
-                    OLC_MEDIA_ASSERT(response == AVERROR_EOF || response == AVERROR(EAGAIN), "Couldn't receive decoded frame");
-                }
-                
-                // We don't want to store empty frame (it could belong to video delay)
-                if (av_video_frame->pkt_size != -1) {
-                    //printf("vpts: %lf\n", CalculateVideoPts(av_video_frame));
+        //Piratimer::start("Convert");
 
-                    //AV_PICTURE_TYPE_B;
+        // Most common formats are converted straight into target, without swscale
+        if (YuvConverter::CanConvert(frame, video_width, video_height)) {
+            ConvertRowsInBands(frame->height, [&](int row_begin, int row_end) {
+                YuvConverter::ConvertRows(frame, target, row_begin, row_end);
+            });
+            return;
+        }
 
-                    video_fifo.push();
-                }
+        // Frames that are already RGB only need their channels reordered
+        if (RgbConverter::CanConvert(frame, video_width, video_height)) {
+            ConvertRowsInBands(frame->height, [&](int row_begin, int row_end) {
+                RgbConverter::ConvertRows(frame, target, row_begin, row_end);
+            });
+            return;
+        }
 
-                //Piratimer::end("DecodeVideoFrame");
-            }
-            else if (IsAudioOpened() && av_packet->stream_index == audio_stream_index) {
-                //printf("ap\n");
-                //Piratimer::start("DecodeAudioFrame");
+        if (video_converter_workers.thread_count() > 1 && ConvertFrameInBands(frame, target))
+            return;
 
-                // Send packet to decode
-                response = avcodec_send_packet(av_audio_codec_ctx, av_packet);
-                if (response < 0) {
-                    OLC_MEDIA_ASSERT(response == AVERROR(EAGAIN), "Failed to decode packet");
-                }
+        // Frame size changes when decoder switches to low resolution decoding, but it's still scaled to the output size
+        AVPixelFormat source_pix_fmt = CorrectDeprecatedPixelFormat((AVPixelFormat)frame->format);
+        sws_video_scaler_ctx = sws_getCachedContext(sws_video_scaler_ctx,
+            frame->width, frame->height, source_pix_fmt,
+            video_width, video_height, AV_PIX_FMT_RGB0,
+            video_scaler_flags, NULL, NULL, NULL
+        );
+        if (sws_video_scaler_ctx == nullptr)
+            return;
 
-                // Single packet can contain multiple frames, so receive them in a loop
-                while (true) {
-                    response = avcodec_receive_frame(av_audio_codec_ctx, av_audio_frame);
-                    if (response < 0) {
-                        OLC_MEDIA_ASSERT(response == AVERROR_EOF || response == AVERROR(EAGAIN), "Something went wrong when trying to receive decoded frame");
-                        break;
-                    }
+        // Target is the pixel storage, that is later swapped into the sprite, so converting straight into it
+        // avoids any copying. swscale falls back to slow C code for rows that aren't 16 byte aligned though.
+        uint8_t* dest[4] = { (uint8_t*)target, NULL, NULL, NULL };
+        int dest_linesize[4] = { video_width * 4, 0, 0, 0 };
+        if (uintptr_t(target) % 16 == 0 && dest_linesize[0] % 16 == 0) {
+            sws_scale(sws_video_scaler_ctx, frame->data, frame->linesize, 0, frame->height, dest, dest_linesize);
+            return;
+        }
 
-                    // We don't want to do anything with empty frame
-                    if (av_audio_frame->pkt_size != -1) {
-                        //printf("af\n");
-                        
-                        //printf("apts: %lf\n", CalculateAudioPts(av_audio_frame));
+        if (temp_video_frame == nullptr) {
+            temp_video_frame = av_frame_alloc();
+            if (temp_video_frame == nullptr)
+                return;
+
+            temp_video_frame->format = AV_PIX_FMT_RGB0;
+            temp_video_frame->width = video_width;
+            temp_video_frame->height = video_height;
+            if (av_frame_get_buffer(temp_video_frame, 0) < 0) {
+                av_frame_free(&temp_video_frame);
+                return;
+            }
+        }
 
-                        // We have to manually copy some frame data
-                        resampled_audio_frame->sample_rate = av_audio_frame->sample_rate;
-                        resampled_audio_frame->channel_layout = av_audio_frame->channel_layout;
-                        resampled_audio_frame->channels = av_audio_frame->channels;
-                        resampled_audio_frame->format = (int)audio_format;
+        sws_scale(sws_video_scaler_ctx, 
+            frame->data, frame->linesize, 0, frame->height, 
+            temp_video_frame->data, temp_video_frame->linesize
+        );
 
-                        response = swr_convert_frame(swr_audio_resampler, resampled_audio_frame, av_audio_frame);
-                        OLC_MEDIA_ASSERT(response == 0, "Couldn't resample the frame");
+        // Manually copy every pixel row from source to the destination target ("linesize", can be longer,
+        // than "width * 4", due to magic alignment, that's why we can't copy entire picture at once)
+        uint8_t* src = temp_video_frame->data[0];
+        uint8_t* dest_row = dest[0];
+        for (int y = 0; y < temp_video_frame->height; y++) {
+            memcpy(dest_row, src, dest_linesize[0]);
 
-                        av_frame_unref(av_audio_frame);
+            src += temp_video_frame->linesize[0];
+            dest_row += dest_linesize[0];
+        }
 
-                        // Insert decoded audio samples
-                        int samples_written = audio_fifo.push((void**)resampled_audio_frame->data, resampled_audio_frame->nb_samples);
-                        static size_t total_written = 0;
-                        total_written += samples_written;
+        //Piratimer::end("Convert");
+    }
 
-                        // Get remaining audio from previous conversion
-                        while (swr_get_delay(swr_audio_resampler, std::max(resampled_audio_frame->sample_rate, av_audio_frame->sample_rate)) > 0) {
-                            response = swr_convert_frame(swr_audio_resampler, resampled_audio_frame, nullptr);
-                            OLC_MEDIA_ASSERT(response == 0, "Couldn't resample the frame");
+    void Media::ConvertRowsInBands(int rows, const std::function<void(int, int)>& convert_rows) {
+        size_t band_count = video_converter_workers.thread_count();
+        video_converter_workers.run(band_count, [&](size_t band) {
+            int row_begin = int(band * rows / band_count);
+            int row_end = int((band + 1) * rows / band_count);
+            if (row_begin < row_end)
+                convert_rows(row_begin, row_end);
+        });
+    }
 
-                            int samples_written = audio_fifo.push((void**)resampled_audio_frame->data, resampled_audio_frame->nb_samples);
-                        }
+    bool Media::ConvertFrameInBands(AVFrame* frame, olc::Pixel* target) {
+        // Vertical scaling filters read rows of neighbouring bands, so only frames of the output size can be split
+        if (frame->width != video_width || frame->height != video_height)
+            return false;
 
-                        //printf("total_written: %llu\n", total_written);
-                        //printf("sw: %i\n", samples_written);
-                    }
-                }
+        // Bands are written straight into target, so rows must be aligned for swscale
+        int dest_linesize = video_width * 4;
+        if (uintptr_t(target) % 16 != 0 || dest_linesize % 16 != 0)
+            return false;
 
-                //Piratimer::end("DecodeAudioFrame");
+        AVPixelFormat source_pix_fmt = CorrectDeprecatedPixelFormat((AVPixelFormat)frame->format);
+        const AVPixFmtDescriptor* descriptor = av_pix_fmt_desc_get(source_pix_fmt);
+        if (descriptor == nullptr || (descriptor->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM)) != 0)
+            return false;
+
+        size_t band_count = video_converter_workers.thread_count();
+        sws_video_band_ctxs.resize(band_count, nullptr);
+        video_band_buffers.resize(band_count);
+
+        // Bands must start at a row, that has its own chroma row
+        int row_alignment = 1 << descriptor->log2_chroma_h;
+        int aligned_rows = (frame->height + row_alignment - 1) / row_alignment;
+
+        // Upsampling chroma reads chroma rows of neighbouring bands, which would be clamped to the edge of the band
+        // and leave seams. Such bands are converted with extra rows, that are cropped away. Luma isn't scaled at all.
+        int overlap = descriptor->log2_chroma_h > 0 ? band_overlap_rows : 0;
+
+        std::atomic<bool> failed = false;
+        video_converter_workers.run(band_count, [&](size_t band) {
+            int row_begin = int(band * aligned_rows / band_count) * row_alignment;
+            int row_end = std::min(int((band + 1) * aligned_rows / band_count) * row_alignment, frame->height);
+            if (row_begin >= row_end)
+                return;
+
+            // Extra rows start at a multiple of 8 rows, so that they have their own chroma row too
+            int convert_begin = overlap > 0 ? std::max(row_begin - overlap, 0) & ~7 : row_begin;
+            int convert_end = std::min(row_end + overlap, frame->height);
+            int convert_rows = convert_end - convert_begin;
+
+            // Every band is converted as a separate picture with its own context
+            SwsContext*& context = sws_video_band_ctxs[band];
+            context = sws_getCachedContext(context,
+                frame->width, convert_rows, source_pix_fmt,
+                video_width, convert_rows, AV_PIX_FMT_RGB0,
+                video_scaler_flags, NULL, NULL, NULL
+            );
+            if (context == nullptr) {
+                failed = true;
+                return;
             }
-            //std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-            av_packet_unref(av_packet);
-        }
+            // Chroma planes have less rows
+            const uint8_t* source[4] = {};
+            for (int plane = 0; plane < 4 && frame->data[plane] != nullptr; plane++) {
+                int plane_row = (plane == 1 || plane == 2) ? convert_begin >> descriptor->log2_chroma_h : convert_begin;
+                source[plane] = frame->data[plane] + ptrdiff_t(plane_row) * frame->linesize[plane];
+            }
 
-        finished_reading = true;
+            olc::Pixel* band_target = target + ptrdiff_t(row_begin) * video_width;
+            std::vector<olc::Pixel>& buffer = video_band_buffers[band];
+            if (overlap > 0)
+                buffer.resize(size_t(convert_rows) * video_width);
 
-        // Free the resources
-        av_frame_free(&av_audio_frame);
-        av_frame_free(&resampled_audio_frame);
-        av_packet_free(&av_packet);
+            uint8_t* dest[4] = { (uint8_t*)(overlap > 0 ? buffer.data() : band_target), NULL, NULL, NULL };
+            int dest_linesizes[4] = { dest_linesize, 0, 0, 0 };
+            sws_scale(context, source, frame->linesize, 0, convert_rows, dest, dest_linesizes);
 
-        printf("Exiting thread\n");
+            // Rows of the band are contiguous in both
+            if (overlap > 0) {
+                memcpy(band_target, buffer.data() + ptrdiff_t(row_begin - convert_begin) * video_width,
+                    size_t(row_end - row_begin) * video_width * sizeof(olc::Pixel));
+            }
+        });
 
-        return Result::ResSuccess;
+        return failed == false;
     }
 
-    Media::Result Media::AdjustSeekedPosition(double wanted_timepoint) {
-        // TODO: figure out if I should add limit for audio queue size
+    void Media::FreeBandScalers() {
+        for (SwsContext* context : sws_video_band_ctxs)
+            sws_freeContext(context);
 
-        // Maximum amount of frames that can be pre-decoded
-        size_t max_video_queue_size;
+        sws_video_band_ctxs.clear();
+        video_band_buffers.clear();
+    }
 
-        // Minimum amount of frames that should be pre-decoded
-        size_t min_video_queue_size;
-        size_t min_audio_queue_size;
+    Media::StepResult Media::ConvertVideoStep() {
+        if (video_fifo.size() == 0)
+            return video_decoder_finished ? StepResult::Finished : StepResult::Blocked;
+
+        DecodedFrame& decoded_frame = video_fifo.front();
+        double pts = CalculateVideoPts(decoded_frame.frame);
+
+        // Frames of the position before the latest seek are dropped, even if "converted_video_fifo" is full,
+        // so that decoder can reach the seek target without waiting for "GetVideoFrame()"
+        if (IsStaleVideoFrame(decoded_frame.serial) == false) {
+            if (converted_video_fifo.full())
+                return StepResult::Blocked;
+
+            // Don't waste time converting a frame that "GetVideoFrame(delta_time)" would skip anyway.
+            // Presentation time is only known for the position that is currently displayed.
+            bool displayed = decoded_frame.serial == displayed_video_serial;
+            double presentation_time = video_presentation_time;
+            if (displayed == false || presentation_time < 0.0 || pts >= presentation_time) {
+                ConvertedFrame& converted_frame = converted_video_fifo.back();
+                ConvertFrameToRGBA(decoded_frame.frame, converted_frame.pixels.data());
+                converted_frame.pts = pts;
+                converted_frame.serial = decoded_frame.serial;
+
+                // Consumer polls the queue from "GetVideoFrame()", so there's nobody to wake up
+                converted_video_fifo.push();
+            }
+        }
 
-        if (IsVideoOpened()) {
-            // "-1" because resizing is disabled, and it allows to avoid overwriting a frame recevied from "GetVideoFrame()"
-            max_video_queue_size = video_fifo.capacity() - 1;
-            min_video_queue_size = std::max(max_video_queue_size / 2, size_t(1));
+        if (video_fifo.pop())
+            WakePipelineStage(video_decoder_signal);
 
-            //printf("max_v: %llu\n", max_video_queue_size);
-            //printf("min_v: %llu\n", min_video_queue_size);
-        }
+        return StepResult::Progressed;
+    }
 
-        if (IsAudioOpened()) {
-            min_audio_queue_size = std::max(size_t(audio_fifo.capacity() / 2), size_t(1));
+    void Media::UpdateResultSprite() { 
+        video_frames[current_video_frame].Decal()->Update(); 
+    }
 
-            //printf("min_a: %llu\n", min_audio_queue_size);
-        }
+    olc::Decal* Media::GetCurrentVideoDecal() {
+        return video_frames.empty() ? nullptr : video_frames[current_video_frame].Decal();
+    }
 
-        int response;
+    double Media::CalculateVideoPts(const AVFrame* frame) {
+        return VideoTimestampToSeconds(frame->best_effort_timestamp);
+    }
 
-        AVFrame* av_audio_frame = av_frame_alloc();
-        OLC_MEDIA_ASSERT(av_audio_frame != nullptr, "Couldn't allocate resampled AVFrame");
+    Media::StepResult Media::DecodeVideoStep() {
+        int serial;
+        double seek_target;
 
-        // Used to store converted "av_audio_frame"
-        AVFrame* resampled_audio_frame = av_frame_alloc();
-        OLC_MEDIA_ASSERT(resampled_audio_frame != nullptr, "Couldn't allocate resampled AVFrame");
+        // Frames that are still inside the decoder belong to the position before the seek
+        serial = video_packets.serial(seek_target);
+        if (serial != video_decoder_serial) {
+            FlushVideoDecoder(serial, seek_target);
+            return StepResult::Progressed;
+        }
 
-        AVPacket* av_packet = av_packet_alloc();
-        OLC_MEDIA_ASSERT(av_packet != nullptr, "Couldn't allocate resampled AVFrame");
+        // Decoder waits for converter instead of overwriting frames, as converter might be reading them
+        if (video_fifo.full())
+            return StepResult::Blocked;
 
-        bool video_seeked = IsVideoOpened() ? false : true;
-        bool audio_seeked = IsAudioOpened() ? false : true;
+        DecodedFrame& decoded_frame = video_fifo.back();
 
-        while (true) {
-            if (video_seeked && audio_seeked) {
-                if (IsVideoOpened()) {
-                    last_video_pts = CalculateVideoPts(video_fifo.front());
-                    printf("last_video_pts: %lf\n", last_video_pts);
-                    delta_time_accumulator = last_video_pts;
-                }
-                if (IsAudioOpened()) {
-                    double at = audio_time;
-                    printf("audio_time: %lf\n", at);
+        // Receive decoded frame
+        int response = avcodec_receive_frame(av_video_codec_ctx, decoded_frame.frame);
+        if (response == 0) {
+            // After seeking, frames between the keyframe and seek target are only decoded to get to the target
+            if (video_seek_target >= 0.0) {
+                if (CalculateVideoPts(decoded_frame.frame) < video_seek_target) {
+                    av_frame_unref(decoded_frame.frame);
+                    return StepResult::Progressed;
                 }
 
-                break;
+                video_seek_target = -1.0;
+                SetVideoPrerollQuality(false);
+                CompleteSeekStage(video_decoder_serial);
             }
 
-            // Try reading next packet
-            response = av_read_frame(av_format_ctx, av_packet);
-
-            // Return if error or end of file was encountered
-            if (response < 0) {
-                printf("Error or end of file happened\n");
-                printf("Exit info: %s\n", GetError(response));
+            decoded_frame.serial = video_decoder_serial;
+            if (video_fifo.push())
+                WakePipelineStage(video_converter_signal);
 
-                // TODO: check if response is error or end of file
-                break;
-            }
+            return StepResult::Progressed;
+        }
 
-            if (IsVideoOpened() && av_packet->stream_index == video_stream_index) {
-                //printf("vp\n");
-                //Piratimer::start("Skip_VideoFrame");
+        if (response == AVERROR_EOF) {
+            if (video_decoder_finished == false) {
+                video_decoder_finished = true;
+                WakePipelineStage(video_converter_signal);
 
-                // Drain a frame when max size is reached
-                if (max_video_queue_size == video_fifo.size()) {
-                    video_fifo.pop();
+                // Seek target was past the last frame
+                if (video_seek_target >= 0.0) {
+                    video_seek_target = -1.0;
+                    SetVideoPrerollQuality(false);
+                    CompleteSeekStage(video_decoder_serial);
                 }
+            }
 
+            return StepResult::Finished;
+        }
 
-                AVFrame* av_video_frame = video_fifo.back();
-
-                // Send packet to decode
-                response = avcodec_send_packet(av_video_codec_ctx, av_packet);
-                OLC_MEDIA_ASSERT(response == 0, "Couldn't decode packet");
+        OLC_MEDIA_ASSERT_RETURN(response == AVERROR(EAGAIN), "Couldn't receive decoded frame", StepResult::Error);
 
-                // Receive decoded frame
-                response = avcodec_receive_frame(av_video_codec_ctx, av_video_frame);
-                if (response < 0) {
-                    OLC_MEDIA_ASSERT(response == AVERROR_EOF || response == AVERROR(EAGAIN), "Couldn't receive decoded frame");
-                }
+        // Decoder needs more packets
+        if (video_packets.pop(av_video_packet, serial, seek_target)) {
+            if (video_packets.size() < min_queued_packets)
+                WakePipelineStage(demuxer_signal);
 
-                // We don't want to store empty frame (it could belong to video delay)
-                if (av_video_frame->pkt_size != -1) {
-                    //printf("v_pts: %lf\n", CalculateVideoPts(av_video_frame));
+            // Seek might have happened since the serial was checked
+            if (serial != video_decoder_serial)
+                FlushVideoDecoder(serial, seek_target);
 
-                    // Skip frames that appear before timepoint
-                    if (CalculateVideoPts(av_video_frame) >= wanted_timepoint) {
-                        video_seeked = true;
+            if (video_seek_target >= 0.0)
+                UpdateVideoPrerollQuality(av_video_packet);
 
-                        video_fifo.push();
-                    }
-                }
+            OLC_MEDIA_ASSERT_RETURN(UpdateVideoDecodeQuality(av_video_packet) == Result::ResSuccess, "Couldn't change video decoding quality", StepResult::Error);
 
-                //Piratimer::end("Skip_VideoFrame");
+            // There is no point in sending packets that decoder would discard anyway
+            if (video_keyframes_only && (av_video_packet->flags & AV_PKT_FLAG_KEY) == 0) {
+                av_packet_unref(av_video_packet);
+                return StepResult::Progressed;
             }
-            else if (IsAudioOpened() && av_packet->stream_index == audio_stream_index) {
-                //printf("ap\n");
-                ////Piratimer::start("DecodeAudioFrame");
 
-                // Send packet to decode
-                response = avcodec_send_packet(av_audio_codec_ctx, av_packet);
-                if (response < 0) {
-                    OLC_MEDIA_ASSERT(response == AVERROR(EAGAIN), "Failed to decode packet");
-                }
+            // Send packet to decode
+            response = avcodec_send_packet(av_video_codec_ctx, av_video_packet);
+            av_packet_unref(av_video_packet);
+            OLC_MEDIA_ASSERT_RETURN(response == 0, "Couldn't decode packet", StepResult::Error);
 
-                // Single packet can contain multiple frames, so receive them in a loop
-                while (true) {
-                    response = avcodec_receive_frame(av_audio_codec_ctx, av_audio_frame);
-                    if (response < 0) {
-                        OLC_MEDIA_ASSERT(response == AVERROR_EOF || response == AVERROR(EAGAIN), "Something went wrong when trying to receive decoded frame");
-                        break;
-                    }
+            return StepResult::Progressed;
+        }
 
-                    // We don't want to do anything with empty frame
-                    if (av_audio_frame->pkt_size != -1) {
-                        //printf("af\n");
+        // Flush frames that are delayed inside decoder, once demuxer reached the end
+        if (video_packets.finished() && video_decoder_draining == false) {
+            video_decoder_draining = true;
+            avcodec_send_packet(av_video_codec_ctx, nullptr);
+            return StepResult::Progressed;
+        }
 
-                        //printf("a_pts: %lf\n", CalculateAudioPts(av_audio_frame));
+        return StepResult::Blocked;
+    }
 
-                        if (CalculateAudioPts(av_audio_frame) >= wanted_timepoint) {
-                            // Keep track of, when the first sample starts
-                            if (audio_seeked == false) {
-                                // TODO: test out if this always works
-                                
-                                audio_time = CalculateAudioPts(av_audio_frame);
-                                audio_frames_consumed = size_t(audio_time * audio_sample_rate);
-                            }
+    void Media::FlushVideoDecoder(int serial, double seek_target) {
+        avcodec_flush_buffers(av_video_codec_ctx);
 
-                            audio_seeked = true;
+        video_decoder_serial = serial;
+        video_seek_target = seek_target;
+        video_decoder_draining = false;
+        video_decoder_finished = false;
 
-                            // We have to manually copy some frame data
-                            resampled_audio_frame->sample_rate = av_audio_frame->sample_rate;
-                            resampled_audio_frame->channel_layout = av_audio_frame->channel_layout;
-                            resampled_audio_frame->channels = av_audio_frame->channels;
-                            resampled_audio_frame->format = (int)audio_format;
+        // Decoder starts from a keyframe, which is far from the target most of the time
+        SetVideoPrerollQuality(seek_target >= 0.0);
+    }
 
-                            response = swr_convert_frame(swr_audio_resampler, resampled_audio_frame, av_audio_frame);
-                            OLC_MEDIA_ASSERT(response == 0, "Couldn't resample the frame");
+    void Media::UpdateVideoPrerollQuality(const AVPacket* packet) {
+        // Without timestamp it's unknown how far the target is, so decoding it at full quality is the safe choice
+        if (packet->pts == AV_NOPTS_VALUE) {
+            SetVideoPrerollQuality(false);
+            return;
+        }
 
-                            av_frame_unref(av_audio_frame);
+        SetVideoPrerollQuality(VideoTimestampToSeconds(packet->pts) < video_seek_target - video_full_quality_seek_window);
+    }
 
-                            // Insert decoded audio samples
-                            int samples_written = audio_fifo.push((void**)resampled_audio_frame->data, resampled_audio_frame->nb_samples);
-                            static size_t total_written = 0;
-                            total_written += samples_written;
+    void Media::SetVideoPrerollQuality(bool enabled) {
+        video_preroll_quality = enabled;
+        ApplyVideoSkipHints();
+    }
 
-                            // Get remaining audio from previous conversion
-                            while (swr_get_delay(swr_audio_resampler, std::max(resampled_audio_frame->sample_rate, av_audio_frame->sample_rate)) > 0) {
-                                response = swr_convert_frame(swr_audio_resampler, resampled_audio_frame, nullptr);
-                                OLC_MEDIA_ASSERT(response == 0, "Couldn't resample the frame");
+    Media::Result Media::UpdateVideoDecodeQuality(const AVPacket* packet) {
+        VideoDecodeQuality quality = video_decode_quality;
+        bool keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
 
-                                int samples_written = audio_fifo.push((void**)resampled_audio_frame->data, resampled_audio_frame->nb_samples);
-                            }
-                        }
+        // Decoder can only start decoding from a keyframe, so these steps are only raised at keyframes
+        if (quality >= VideoDecodeQuality::KeyframesOnly)
+            video_keyframes_only = true;
+        else if (keyframe)
+            video_keyframes_only = false;
 
-                        //printf("total_written: %llu\n", total_written);
-                        //printf("sw: %i\n", samples_written);
-                    }
-                }
+        if (keyframe) {
+            int lowres = quality >= VideoDecodeQuality::LowResolution && video_supports_lowres ? 1 : 0;
 
-                ////Piratimer::end("DecodeAudioFrame");
+            // Most decoders only read "lowres" when they are opened.
+            // Frames that are still delayed inside the old decoder are lost, but quality is only changed while falling behind.
+            if (lowres != av_video_codec_ctx->lowres) {
+                OLC_MEDIA_ASSERT(OpenVideoDecoder(lowres) == Result::ResSuccess, "Couldn't reopen video decoder");
             }
-            //std::this_thread::sleep_for(std::chrono::milliseconds(10));
-
-            av_packet_unref(av_packet);
         }
 
-        // Free the resources
-        av_frame_free(&av_audio_frame);
-        av_frame_free(&resampled_audio_frame);
-        av_packet_free(&av_packet);
+        ApplyVideoSkipHints();
 
         return Result::ResSuccess;
     }
 
-    // av_err2str returns a temporary array. This doesn't work in gcc.
-    // This function can be used as a replacement for av_err2str.
-    const char* Media::GetError(int errnum) {
-        static char str[AV_ERROR_MAX_STRING_SIZE];
-        memset(str, 0, sizeof(str));
-        return av_make_error_string(str, AV_ERROR_MAX_STRING_SIZE, errnum);
-    }
+    void Media::ApplyVideoSkipHints() {
+        VideoDecodeQuality quality = video_decode_quality;
 
-    Media::Result Media::ApplySettings() {
-        OLC_MEDIA_ASSERT(settings.preloaded_frames_scale > 0, "\"preloaded_frames_scale\" can't be 0");
+        // Non reference frames aren't used to decode other frames, so skipping them doesn't affect the seek target frame.
+        // Skipping loop filter on reference frames may leave small artifacts until the next keyframe, so during seek
+        // it's only done until packets get close to the target.
+        bool skip_loop_filter = video_preroll_quality || quality >= VideoDecodeQuality::SkipLoopFilter;
+        bool discard_non_reference = video_preroll_quality || quality >= VideoDecodeQuality::DiscardNonReference;
 
-        return Result::ResSuccess;
+        av_video_codec_ctx->skip_loop_filter = skip_loop_filter ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+        av_video_codec_ctx->skip_frame = discard_non_reference ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
     }
 
-    Media::Result Media::InitVideo() {
+    Media::Result Media::OpenVideoDecoder(int lowres) {
         int response;
 
-        AVCodecParameters* av_video_codec_params = nullptr;
-
-        video_stream_index = av_find_best_stream(av_format_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, (AVCodec**)&av_video_codec, 0);
-        if (video_stream_index < 0) {
-            if (video_stream_index == AVERROR_STREAM_NOT_FOUND) {
-                // TODO: might change it later
-                return Result::ResSuccess;
-            }
-            else if (video_stream_index == AVERROR_DECODER_NOT_FOUND) {
-                OLC_MEDIA_ASSERT(false, "Couldn't find decoder for any of the video streams");
-            }
-            else {
-                OLC_MEDIA_ASSERT(false, "Unknown error occured when trying to find video stream");
-            }
-        }
-
-        av_video_codec_params = av_format_ctx->streams[video_stream_index]->codecpar;
-
-        //av_dump_format(av_format_ctx, video_stream_index, "assets/DWIG - Orange Evening  Laut & Luise (LUL007).mp3", 0);
-        av_dump_format(av_format_ctx, video_stream_index, "assets/face.jpg", 0);
-        //printf("fps: %f\n", av_q2d(av_video_format_ctx->streams[video_stream_index]->avg_frame_rate));
-        //av_video_format_ctx->streams[video_stream_index]->avg_frame_rate;
+        avcodec_free_context(&av_video_codec_ctx);
 
         // Set up a codec context for the decoder
         av_video_codec_ctx = avcodec_alloc_context3(av_video_codec);
         OLC_MEDIA_ASSERT(av_video_codec_ctx != nullptr, "Couldn't create AVCodecContext");
 
-        response = avcodec_parameters_to_context(av_video_codec_ctx, av_video_codec_params);
+        response = avcodec_parameters_to_context(av_video_codec_ctx, av_format_ctx->streams[video_stream_index]->codecpar);
         OLC_MEDIA_ASSERT(response >= 0, "Couldn't send parameters to AVCodecContext");
 
+        SetupVideoDecoderThreading();
+        av_video_codec_ctx->lowres = lowres;
+
         response = avcodec_open2(av_video_codec_ctx, av_video_codec, NULL);
         OLC_MEDIA_ASSERT(response == 0, "Couldn't initialise AVCodecContext");
 
-        AVPixelFormat source_pix_fmt = Media::CorrectDeprecatedPixelFormat(av_video_codec_ctx->pix_fmt);
-        sws_video_scaler_ctx = sws_getContext(
-            av_video_codec_params->width, av_video_codec_params->height, source_pix_fmt,
-            av_video_codec_params->width, av_video_codec_params->height, AV_PIX_FMT_RGB0,
-            SWS_BILINEAR, NULL, NULL, NULL
-        );
-        OLC_MEDIA_ASSERT(sws_video_scaler_ctx != nullptr, "Couldn't initialise SwsContext");
-
-        // Minimum video fifo capacity must stay 2, regardless of video fps
-        if (HasAlbumArt()) {
-            video_fifo.init(2);
-        }
-        else {
-            // TODO: Need to figure out if there is better way to calculate required video frame buffer size
-            Result result = video_fifo.init(120);
-            OLC_MEDIA_ASSERT(result == Result::ResSuccess, "Couldn't allocate video fifo");
-        }
-        
-
         // Not sure if this is needed for video streams, but I'll leave it anyway
         av_video_codec_ctx->pkt_timebase = av_format_ctx->streams[video_stream_index]->time_base;
 
-        attached_pic = (av_format_ctx->streams[video_stream_index]->disposition & AV_DISPOSITION_ATTACHED_PIC) ? true : false;
-        video_opened = true;
-        video_width = av_video_codec_params->width;
-        video_height = av_video_codec_params->height;
-        video_frame.Create(video_width, video_height);
-        video_time_base = av_format_ctx->streams[video_stream_index]->time_base;
-        video_delay = av_video_codec_params->video_delay;
-
-        temp_video_frame = av_frame_alloc();
-        temp_video_frame->format = AV_PIX_FMT_RGB0;
-        temp_video_frame->width = video_width;
-        temp_video_frame->height = video_height;
-        av_frame_get_buffer(temp_video_frame, 0);
-
-        // Reset values if video was previously opened
-        delta_time_accumulator = 0.0f;
-        last_video_pts = 0.0;
-
-        PrintVideoInfo();
-
         return Result::ResSuccess;
     }
 
-    void Media::CloseVideo() {
-        avcodec_free_context(&av_video_codec_ctx);
-        sws_freeContext(sws_video_scaler_ctx);
-        sws_video_scaler_ctx = nullptr;
-        av_frame_free(&temp_video_frame);
-
-        attached_pic = false;
-        video_opened = false;
-        video_fifo.clear();
-        video_fifo.free();
-
-        // Doesn't fully clear memory, but better than nothing
-        video_frame.Create(0, 0);
-    }
-
-    void Media::ConvertFrameToRGBASprite(AVFrame* frame, olc::Sprite* target) {
-        // TODO: implement some error checking
-
-        //Piratimer::start("Convert");
+    void Media::AdaptVideoDecodeQuality(double lateness) {
+        if (settings.adaptive_video_quality == false)
+            return;
 
-        sws_scale(sws_video_scaler_ctx, 
-            frame->data, frame->linesize, 0, frame->height, 
-            temp_video_frame->data, temp_video_frame->linesize
-        );
+        auto now = std::chrono::steady_clock::now();
+        double frame_duration = GetVideoFrameDuration();
 
-        // Manually copy every pixel row from source to the destination target ("linesize", can be longer,
-        // than "width * 4", due to magic alignment, that's why we can't copy entire picture at once)
-        uint8_t* src = temp_video_frame->data[0];
-        uint8_t* dest = (uint8_t*)target->pColData.data();
-        for (int y = 0; y < temp_video_frame->height; y++) {
-            memcpy(dest, src, target->width * 4);
+        int state = 0;
+        if (lateness > video_late_frames * frame_duration)
+            state = 1;
+        else if (lateness < video_on_time_frames * frame_duration)
+            state = -1;
 
-            src += temp_video_frame->linesize[0];
-            dest += target->width * 4;
+        if (state != video_lateness_state) {
+            video_lateness_state = state;
+            video_lateness_state_start = now;
+            return;
         }
 
-        // Convert pixel format from (most likely) YUV representation to RGBA
-        /*uint8_t* dest[4] = {(uint8_t*)(target->pColData), NULL, NULL, NULL};
-        int dest_linesize[4] = { video_width * 4, 0, 0, 0 };
-        sws_scale(sws_video_scaler_ctx, frame->data, frame->linesize, 0, frame->height, dest, dest_linesize);*/
+        // Give decoder some time to show the effect of the previous change
+        std::chrono::steady_clock::duration delay = state > 0 ? video_quality_lower_delay : video_quality_raise_delay;
+        if (state == 0 || now - video_lateness_state_start < delay || now - video_quality_change_time < delay)
+            return;
 
-        
+        int quality = int(video_decode_quality.load()) + state;
 
-        //Piratimer::end("Convert");
-        //Piratimer::start("UpdateResultSprite");
+        // Low resolution step doesn't do anything if codec doesn't support it
+        if (VideoDecodeQuality(quality) == VideoDecodeQuality::LowResolution && video_supports_lowres == false)
+            quality += state;
 
-        UpdateResultSprite();
+        if (quality < int(VideoDecodeQuality::Full) || quality > int(VideoDecodeQuality::KeyframesOnly))
+            return;
 
-        //Piratimer::end("UpdateResultSprite");
+        video_decode_quality = VideoDecodeQuality(quality);
+        video_quality_change_time = now;
+        video_lateness_state_start = now;
     }
 
-    void Media::UpdateResultSprite() { 
-        video_frame.Decal()->Update(); 
+    double Media::GetVideoFrameDuration() {
+        if (IsVideoOpened() && GetAverageVideoFPS() > 0.0)
+            return 1.0 / GetAverageVideoFPS();
+
+        return 1.0 / 30.0;
     }
 
-    double Media::CalculateVideoPts(const AVFrame* frame) {
-        return double(frame->best_effort_timestamp * video_time_base.num) / double(video_time_base.den);
+    bool Media::IsStaleVideoFrame(int serial) {
+        // Album art isn't seeked, so its frame is never stale
+        return HasAlbumArt() == false && serial != seek_serial;
     }
 
-    const AVFrame* Media::PeekFrame() {
-        if (video_fifo.size() > 0) {
-            return video_fifo.front();
+    const Media::ConvertedFrame* Media::PeekFrame() {
+        while (converted_video_fifo.size() > 0) {
+            if (IsStaleVideoFrame(converted_video_fifo.front().serial) == false)
+                return &converted_video_fifo.front();
+
+            if (converted_video_fifo.pop())
+                WakePipelineStage(video_converter_signal);
         }
 
         return nullptr;
@@ -1833,15 +5695,71 @@ namespace olc {
         }
     }
 
+    size_t Media::CalculateVideoQueueCapacity() {
+        AVStream* video_stream = av_format_ctx->streams[video_stream_index];
+
+        double fps = av_q2d(video_stream->avg_frame_rate);
+        if (fps <= 0.0)
+            fps = av_q2d(video_stream->r_frame_rate);
+        if (fps <= 0.0)
+            fps = 30.0;
+
+        double preroll_seconds = double(settings.video_preroll_ms) / 1000.0 * settings.preloaded_frames_scale;
+        size_t capacity = size_t(std::ceil(fps * preroll_seconds));
+
+        // Converted frames are always allocated, so decoded frames get what's left of the budget
+        if (settings.video_memory_budget > 0) {
+            size_t converted_bytes = converted_video_fifo.bytes();
+            size_t budget = settings.video_memory_budget > converted_bytes ? settings.video_memory_budget - converted_bytes : 0;
+            capacity = std::min(capacity, budget / std::max(video_frame_bytes, size_t(1)));
+        }
+
+        // "VideoQueue::init()" takes 16 bit capacity
+        return std::min(std::max(capacity, size_t(2)), size_t(UINT16_MAX));
+    }
+
+    void Media::SetupVideoDecoderThreading() {
+        int thread_count = settings.video_decoder_thread_count;
+        if (thread_count == 0) {
+            // FFMPEG warns about using more than 16 threads for most decoders, as it gives little to no benefit
+            thread_count = std::min(int(std::thread::hardware_concurrency()), 16);
+
+            // If core count can't be detected, let FFMPEG figure it out itself
+            if (thread_count <= 0)
+                thread_count = 0;
+        }
+
+        av_video_codec_ctx->thread_count = thread_count;
+
+        switch (settings.video_decoder_thread_type) {
+        case DecoderThreadType::Frame:
+            av_video_codec_ctx->thread_type = FF_THREAD_FRAME;
+            break;
+
+        case DecoderThreadType::Slice:
+            av_video_codec_ctx->thread_type = FF_THREAD_SLICE;
+            break;
+
+        // FFMPEG prefers frame threading when both are allowed and the codec supports it
+        case DecoderThreadType::Auto:
+        default:
+            av_video_codec_ctx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+            break;
+        }
+    }
+
     Media::Result Media::InitAudio() {
         int response;
         Result result;
 
         AVCodecParameters* av_audio_codec_params = nullptr;
 
-        audio_stream_index = av_find_best_stream(av_format_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, (AVCodec**)&av_audio_codec, 0);
+        audio_stream_index = av_find_best_stream(av_format_ctx, AVMEDIA_TYPE_AUDIO, settings.audio_stream, -1, (AVCodec**)&av_audio_codec, 0);
         if (audio_stream_index < 0) {
-            if (audio_stream_index == AVERROR_STREAM_NOT_FOUND) {
+            if (settings.audio_stream >= 0) {
+                OLC_MEDIA_ASSERT(false, "Selected audio stream doesn't exist, isn't an audio stream or has no decoder");
+            }
+            else if (audio_stream_index == AVERROR_STREAM_NOT_FOUND) {
                 // TODO: might change it later
                 return Result::ResSuccess;
             }   
@@ -1875,18 +5793,26 @@ namespace olc {
         );
         OLC_MEDIA_ASSERT(swr_audio_resampler != nullptr, "Couldn't allocate SwrContext");
 
+        av_audio_packet = av_packet_alloc();
+        OLC_MEDIA_ASSERT(av_audio_packet != nullptr, "Couldn't allocate AVPacket");
+
+        av_audio_frame = av_frame_alloc();
+        OLC_MEDIA_ASSERT(av_audio_frame != nullptr, "Couldn't allocate AVFrame");
+
+        resampled_audio_frame = av_frame_alloc();
+        OLC_MEDIA_ASSERT(resampled_audio_frame != nullptr, "Couldn't allocate resampled AVFrame");
+
         // Should be set when decoding
         av_audio_codec_ctx->pkt_timebase = av_format_ctx->streams[audio_stream_index]->time_base;
 
         audio_time_base = av_format_ctx->streams[audio_stream_index]->time_base;
         audio_channel_count = av_audio_codec_params->channels;
         audio_sample_rate = av_audio_codec_params->sample_rate;
+        audio_seek_preroll = std::max(double(av_audio_codec_params->seek_preroll) / double(audio_sample_rate), min_audio_seek_preroll);
 
-        // Reset values if audio was previously opened
-        audio_frames_consumed = 0;
-        audio_time = 0.0;
-
-        result = audio_fifo.init(audio_format, av_audio_codec_params->channels, settings.preloaded_frames_scale * av_audio_codec_params->sample_rate);
+        // Decoder is woken up once half of the samples were consumed
+        int audio_fifo_capacity = settings.preloaded_frames_scale * av_audio_codec_params->sample_rate;
+        result = audio_fifo.init(audio_format, av_audio_codec_params->channels, audio_fifo_capacity, audio_fifo_capacity / 2);
         OLC_MEDIA_ASSERT(result == Result::ResSuccess, "Couldn't allocate audio fifo");
 
         result = InitialiseAndStartMiniaudio();
@@ -1901,6 +5827,9 @@ namespace olc {
 
     void Media::CloseAudio() {
         avcodec_free_context(&av_audio_codec_ctx);
+        av_packet_free(&av_audio_packet);
+        av_frame_free(&av_audio_frame);
+        av_frame_free(&resampled_audio_frame);
         swr_free(&swr_audio_resampler);
         ma_device_uninit(&audio_device);
 
@@ -1913,6 +5842,169 @@ namespace olc {
         return double(frame->best_effort_timestamp * audio_time_base.num) / double(audio_time_base.den);
     }
 
+    Media::StepResult Media::DecodeAudioStep() {
+        int serial;
+        double seek_target;
+
+        // Frames that are still inside the decoder belong to the position before the seek
+        serial = audio_packets.serial(seek_target);
+        if (serial != audio_decoder_serial) {
+            FlushAudioDecoder(serial, seek_target);
+            return StepResult::Progressed;
+        }
+
+        // Samples that didn't fit into "audio_fifo" have to be pushed before decoding anything else.
+        // Playback callback wakes the decoder once "audio_fifo" drops to its low watermark.
+        if (pending_audio_samples > 0) {
+            if (PushPendingAudioSamples() == false)
+                return StepResult::Blocked;
+
+            // Get remaining audio from previous conversion
+            if (swr_get_delay(swr_audio_resampler, resampled_audio_frame->sample_rate) > 0) {
+                OLC_MEDIA_ASSERT_RETURN(ResampleAudioFrame(nullptr) == Result::ResSuccess, "Couldn't resample the frame", StepResult::Error);
+                return StepResult::Progressed;
+            }
+        }
+
+        // Single packet can contain multiple frames, so frames are received until decoder asks for more data
+        int response = avcodec_receive_frame(av_audio_codec_ctx, av_audio_frame);
+        if (response == 0) {
+            // We don't want to do anything with empty frame
+            if (av_audio_frame->pkt_size != -1) {
+                bool play_frame = true;
+
+                // After seeking, frames before seek target are only decoded to get to the target
+                if (audio_seek_target >= 0.0) {
+                    double pts = CalculateAudioPts(av_audio_frame);
+                    play_frame = pts >= audio_seek_target;
+
+                    if (play_frame) {
+                        // Audio time continues from the first sample that will be played
+                        audio_fifo.restart(pts, audio_decoder_serial);
+                        audio_seek_target = -1.0;
+                        CompleteSeekStage(audio_decoder_serial);
+                    }
+                }
+
+                if (play_frame) {
+                    OLC_MEDIA_ASSERT_RETURN(ResampleAudioFrame(av_audio_frame) == Result::ResSuccess, "Couldn't resample the frame", StepResult::Error);
+                }
+            }
+
+            av_frame_unref(av_audio_frame);
+            return StepResult::Progressed;
+        }
+
+        if (response == AVERROR_EOF) {
+            if (audio_decoder_finished == false) {
+                audio_decoder_finished = true;
+
+                // Seek target was past the last frame
+                if (audio_seek_target >= 0.0) {
+                    audio_seek_target = -1.0;
+                    CompleteSeekStage(audio_decoder_serial);
+                }
+            }
+
+            return StepResult::Finished;
+        }
+
+        OLC_MEDIA_ASSERT_RETURN(response == AVERROR(EAGAIN), "Something went wrong when trying to receive decoded frame", StepResult::Error);
+
+        // Decoder needs more packets
+        if (audio_packets.pop(av_audio_packet, serial, seek_target)) {
+            if (audio_packets.size() < min_queued_packets)
+                WakePipelineStage(demuxer_signal);
+
+            // Seek might have happened since the serial was checked
+            if (serial != audio_decoder_serial)
+                FlushAudioDecoder(serial, seek_target);
+
+            // Frames of these packets would be thrown away after decoding anyway
+            if (audio_seek_target >= 0.0 && IsAudioPacketBeforeSeekTarget(av_audio_packet)) {
+                av_packet_unref(av_audio_packet);
+                return StepResult::Progressed;
+            }
+
+            // Send packet to decode
+            response = avcodec_send_packet(av_audio_codec_ctx, av_audio_packet);
+            av_packet_unref(av_audio_packet);
+            if (response < 0) {
+                OLC_MEDIA_ASSERT_RETURN(response == AVERROR(EAGAIN), "Failed to decode packet", StepResult::Error);
+            }
+
+            return StepResult::Progressed;
+        }
+
+        // Flush frames that are delayed inside decoder, once demuxer reached the end
+        if (audio_packets.finished() && audio_decoder_draining == false) {
+            audio_decoder_draining = true;
+            avcodec_send_packet(av_audio_codec_ctx, nullptr);
+            return StepResult::Progressed;
+        }
+
+        return StepResult::Blocked;
+    }
+
+    void Media::FlushAudioDecoder(int serial, double seek_target) {
+        avcodec_flush_buffers(av_audio_codec_ctx);
+
+        // Drop samples of the old position that are delayed inside the resampler, or didn't fit into "audio_fifo"
+        swr_init(swr_audio_resampler);
+        pending_audio_samples = 0;
+        pending_audio_offset = 0;
+
+        audio_decoder_serial = serial;
+        audio_seek_target = seek_target;
+        audio_decoder_draining = false;
+        audio_decoder_finished = false;
+
+        // Samples of the old position stop playing right away. Audio time is corrected once the first frame at
+        // seek target is decoded.
+        audio_fifo.restart(std::max(seek_target, 0.0), serial);
+    }
+
+    bool Media::IsAudioPacketBeforeSeekTarget(const AVPacket* packet) {
+        if (packet->pts == AV_NOPTS_VALUE)
+            return false;
+
+        double packet_end = double((packet->pts + packet->duration) * audio_time_base.num) / double(audio_time_base.den);
+        return packet_end < audio_seek_target - audio_seek_preroll;
+    }
+
+    double Media::GetAudioTime() {
+        // I'm only storing raw audio data, so audio time stamp is calculated from how many samples were played since the seek
+        return audio_fifo.played_time(audio_sample_rate);
+    }
+
+    Media::Result Media::ResampleAudioFrame(const AVFrame* input) {
+        // We have to manually copy some frame data
+        if (input != nullptr) {
+            resampled_audio_frame->sample_rate = input->sample_rate;
+            resampled_audio_frame->channel_layout = input->channel_layout;
+            resampled_audio_frame->channels = input->channels;
+            resampled_audio_frame->format = (int)audio_format;
+        }
+
+        int response = swr_convert_frame(swr_audio_resampler, resampled_audio_frame, input);
+        OLC_MEDIA_ASSERT(response == 0, "Couldn't resample the frame");
+
+        pending_audio_samples = resampled_audio_frame->nb_samples;
+        pending_audio_offset = 0;
+
+        return Result::ResSuccess;
+    }
+
+    bool Media::PushPendingAudioSamples() {
+        uint8_t* data = resampled_audio_frame->data[0] + pending_audio_offset * audio_fifo.sample_bytes();
+
+        int samples_written = audio_fifo.push((void**)&data, pending_audio_samples);
+        pending_audio_samples -= samples_written;
+        pending_audio_offset += samples_written;
+
+        return pending_audio_samples == 0;
+    }
+
     Media::Result Media::ChooseAudioFormat() {
         switch (settings.audio_format) {
         case AudioFormat::Default:
@@ -0,0 +1,401 @@
+// Benchmarks of olcPGEX_Media internals. Run with the name of a benchmark, or without arguments to list them.
+//
+// Build from the repository root (olcPixelGameEngine.h and miniaudio.h have to be next to olcPGEX_Media.h):
+//   g++ -std=c++17 -O2 -I. olcPGEX_Media_bench.cpp -o olcPGEX_Media_bench -lavformat -lavcodec -lswscale -lswresample -lavutil -lX11 -lGL -lpng -lpthread -lstdc++fs
+
+#define OLC_PGE_APPLICATION
+#include "olcPixelGameEngine.h"
+
+#include "olcPGEX_Media.h"
+
+#include <random>
+#include <thread>
+
+namespace olc {
+    // Reaches the internals of the player (see "friend struct MediaTestAccess" in olcPGEX_Media.h)
+    struct MediaTestAccess {
+        // Sets up the state video conversion needs, without opening any media
+        static void SetVideoOutput(Media& media, int width, int height, int scaler_flags) {
+            media.video_width = width;
+            media.video_height = height;
+            media.video_scaler_flags = scaler_flags;
+        }
+
+        static void ConvertFrame(Media& media, AVFrame* frame, olc::Pixel* target) {
+            media.ConvertFrameToRGBA(frame, target);
+        }
+
+        // Threads that convert bands of a frame, including the calling one
+        static void StartConverterThreads(Media& media, size_t thread_count) {
+            media.video_converter_workers.start(thread_count);
+        }
+
+        static void StopConverterThreads(Media& media) {
+            media.video_converter_workers.stop();
+            media.FreeBandScalers();
+        }
+
+        // Opens the backend, that the player opens for the given i/o type. Returns nullptr if it can't be opened.
+        static std::unique_ptr<Media::IOContext::Backend> OpenBackend(Media::IOContext& io, const Media::FileName& filename,
+            Media::FileIOType type, size_t readahead_size, unsigned uring_reads) {
+            io.uringReads = uring_reads;
+
+            Media::MediaSource source;
+            source.filename = &filename;
+            std::unique_ptr<Media::IOContext::Backend> backend = io.openBackend(source, type);
+
+            // Same condition as in "initAVFmtCtx()"
+            if (backend != nullptr && readahead_size > 0 && io.isInMemory == false && io.isReadAhead == false)
+                backend.reset(new Media::IOContext::ReadaheadBackend(std::move(backend), readahead_size));
+
+            return backend;
+        }
+
+        // Reads the whole file through the backend, that the player opens for the given i/o type.
+        // Returns amount of bytes read, or -1 if the backend can't be opened.
+        static int64_t ReadFile(const Media::FileName& filename, Media::FileIOType type, size_t readahead_size, unsigned uring_reads, size_t chunk_size) {
+            Media::IOContext io;
+            std::unique_ptr<Media::IOContext::Backend> backend = OpenBackend(io, filename, type, readahead_size, uring_reads);
+            if (backend == nullptr)
+                return -1;
+
+            std::vector<uint8_t> buffer(chunk_size);
+            int64_t total = 0;
+            for (int64_t len; (len = backend->read(buffer.data(), int64_t(chunk_size))) > 0;)
+                total += len;
+
+            return total;
+        }
+
+        // Seeks to random offsets and reads "read_size" bytes after each one, like the demuxer does when seeking.
+        // Returns amount of bytes read, or -1 if the backend can't be opened.
+        static int64_t ReadRandom(const Media::FileName& filename, Media::FileIOType type, size_t readahead_size, unsigned uring_reads,
+            int seek_count, size_t read_size, size_t chunk_size, uint32_t seed) {
+            Media::IOContext io;
+            std::unique_ptr<Media::IOContext::Backend> backend = OpenBackend(io, filename, type, readahead_size, uring_reads);
+            if (backend == nullptr)
+                return -1;
+
+            int64_t file_size = backend->size();
+            if (file_size <= 0)
+                return -1;
+
+            std::mt19937 offsets(seed);
+            std::vector<uint8_t> buffer(chunk_size);
+            int64_t total = 0;
+            for (int i = 0; i < seek_count; i++) {
+                if (backend->seek(int64_t(offsets() % uint64_t(file_size)), SEEK_SET) < 0)
+                    return -1;
+
+                for (size_t read = 0; read < read_size;) {
+                    int64_t len = backend->read(buffer.data(), int64_t(std::min(chunk_size, read_size - read)));
+                    if (len <= 0)
+                        break;
+
+                    read += size_t(len);
+                    total += len;
+                }
+            }
+
+            return total;
+        }
+
+        // Opens the file like "Open()" does and reads the first packet. Returns false on error.
+        static bool OpenToFirstPacket(const Media::FileName& filename, const Media::Settings& settings) {
+            Media::IOContext io;
+            Media::MediaSource source;
+            source.filename = &filename;
+
+            AVFormatContext* format_ctx = avformat_alloc_context();
+            if (format_ctx == nullptr || io.initAVFmtCtx(source, format_ctx, settings) == false) {
+                avformat_free_context(format_ctx);
+                return false;
+            }
+
+            // Context is freed by "avformat_open_input()" on failure
+            if (avformat_open_input(&format_ctx, "", NULL, NULL) < 0)
+                return false;
+
+            AVPacket* packet = av_packet_alloc();
+            bool success = packet != nullptr && avformat_find_stream_info(format_ctx, nullptr) >= 0 && av_read_frame(format_ctx, packet) >= 0;
+
+            av_packet_free(&packet);
+            avformat_close_input(&format_ctx);
+            return success;
+        }
+    };
+}
+
+typedef olc::MediaTestAccess Access;
+
+static std::mt19937 rng(1234);
+
+template<typename Function>
+static double MeasureMilliseconds(int iterations, Function function) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        function();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+// Frame of the given format, filled with random bytes
+static AVFrame* CreateFrame(AVPixelFormat format, int width, int height) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 64) < 0) {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    const AVPixFmtDescriptor* descriptor = av_pix_fmt_desc_get(format);
+    for (int plane = 0; plane < AV_NUM_DATA_POINTERS && frame->data[plane] != nullptr; plane++) {
+        int rows = (plane == 1 || plane == 2) ? -((-height) >> descriptor->log2_chroma_h) : height;
+        for (size_t i = 0; i < size_t(rows) * frame->linesize[plane]; i++)
+            frame->data[plane][i] = uint8_t(rng());
+    }
+
+    return frame;
+}
+
+// Pixels of a whole frame, aligned the same way sprite storage is
+struct FramePixels {
+    std::vector<olc::Pixel> storage;
+    olc::Pixel* pixels;
+
+    FramePixels(int width, int height) : storage(size_t(width) * height + 16) {
+        pixels = reinterpret_cast<olc::Pixel*>((reinterpret_cast<uintptr_t>(storage.data()) + 63) & ~uintptr_t(63));
+    }
+};
+
+// Frames that swscale converts into the 16 byte aligned pixel storage go straight into it,
+// other frames are converted into a temporary frame and copied row by row.
+static void BenchmarkConvert(int /*argc*/, char** /*argv*/) {
+    const int iterations = 30;
+    const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+
+    printf("yuv422p to RGBA through swscale, single thread\n");
+    printf("%-10s %-12s %10s %10s\n", "size", "path", "ms/frame", "GB/s");
+
+    for (const auto& size : sizes) {
+        int width = size[0];
+        int height = size[1];
+
+        AVFrame* frame = CreateFrame(AV_PIX_FMT_YUV422P, width, height);
+        if (frame == nullptr)
+            continue;
+
+        olc::Media media;
+        Access::SetVideoOutput(media, width, height, SWS_BILINEAR);
+        FramePixels target(width, height);
+
+        // Moving the target by a single pixel is enough to make it unaligned for swscale
+        const struct { const char* name; olc::Pixel* pixels; } paths[] = {
+            { "direct", target.pixels },
+            { "temp+copy", target.pixels + 1 },
+        };
+
+        for (const auto& path : paths) {
+            Access::ConvertFrame(media, frame, path.pixels);
+            double time = MeasureMilliseconds(iterations, [&]() { Access::ConvertFrame(media, frame, path.pixels); });
+            double bytes = double(width) * height * sizeof(olc::Pixel);
+            printf("%4dx%-5d %-12s %10.3f %10.2f\n", width, height, path.name, time, bytes / (time * 1e6));
+        }
+
+        av_frame_free(&frame);
+    }
+}
+
+// Frames are split into bands, that are converted by several threads at once. yuv420p goes through
+// the built-in converter, nv21 and yuv422p through a swscale context per band. Output of every thread count
+// is compared with the single threaded one, which converts the whole frame at once.
+static void BenchmarkBands(int /*argc*/, char** /*argv*/) {
+    const int iterations = 30;
+    const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+    const AVPixelFormat formats[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV21, AV_PIX_FMT_YUV422P };
+    const size_t thread_counts[] = { 1, 2, 4, 8 };
+
+    printf("%-10s %-8s %8s %10s %8s %8s\n", "size", "format", "threads", "ms/frame", "speedup", "output");
+
+    for (const auto& size : sizes) {
+        int width = size[0];
+        int height = size[1];
+        FramePixels target(width, height);
+
+        for (AVPixelFormat format : formats) {
+            AVFrame* frame = CreateFrame(format, width, height);
+            if (frame == nullptr)
+                continue;
+
+            olc::Media media;
+            Access::SetVideoOutput(media, width, height, SWS_BILINEAR);
+
+            double single_thread_time = 0.0;
+            std::vector<olc::Pixel> single_thread_output;
+            for (size_t thread_count : thread_counts) {
+                Access::StartConverterThreads(media, thread_count);
+                Access::ConvertFrame(media, frame, target.pixels);
+                double time = MeasureMilliseconds(iterations, [&]() { Access::ConvertFrame(media, frame, target.pixels); });
+                Access::StopConverterThreads(media);
+
+                size_t pixel_count = size_t(width) * height;
+                if (thread_count == 1) {
+                    single_thread_time = time;
+                    single_thread_output.assign(target.pixels, target.pixels + pixel_count);
+                }
+
+                // Bands must not leave seams, where neighbouring rows are converted by different threads
+                bool same = memcmp(single_thread_output.data(), target.pixels, pixel_count * sizeof(olc::Pixel)) == 0;
+
+                printf("%4dx%-5d %-8s %8zu %10.3f %7.2fx %8s\n", width, height, av_get_pix_fmt_name(format),
+                    thread_count, time, single_thread_time / time, same ? "same" : "DIFFERS");
+            }
+
+            av_frame_free(&frame);
+        }
+    }
+}
+
+// Reads a media file through every backend with the demuxer's read size: opening it up to the first packet,
+// sequential playback and random seeks. The file should be larger than memory, or the page cache dropped
+// before each run ("echo 3 > /proc/sys/vm/drop_caches"), to measure the disk.
+static void BenchmarkIO(int argc, char** argv) {
+    if (argc < 1) {
+        printf("Arguments: <file> [repeats]\n");
+        return;
+    }
+
+    const olc::Media::FileName filename(argv[0]);
+    int repeats = argc >= 2 ? std::max(atoi(argv[1]), 1) : 3;
+    const size_t chunk_size = 4096; // "bufferSize" of the i/o context
+    const size_t readahead_size = olc::Media::Settings().io_readahead_size;
+    const int seek_count = 200;
+    const size_t seek_read_size = 64 * 1024;
+
+    const struct { const char* name; olc::Media::FileIOType type; size_t readahead_size; } backends[] = {
+        { "buffered", olc::Media::FileIOType::Buffered, 0 },
+        { "readahead", olc::Media::FileIOType::Buffered, readahead_size },
+        { "mmap", olc::Media::FileIOType::MemoryMapped, 0 },
+        { "io_uring", olc::Media::FileIOType::IoUring, 0 },
+    };
+
+    printf("Open to the first packet\n%-10s %10s\n", "backend", "ms");
+    for (const auto& backend : backends) {
+        olc::Media::Settings settings;
+        settings.file_io = backend.type;
+        settings.io_readahead_size = backend.readahead_size;
+
+        bool success = true;
+        double time = MeasureMilliseconds(repeats, [&]() { success = Access::OpenToFirstPacket(filename, settings) && success; });
+
+        if (success)
+            printf("%-10s %10.2f\n", backend.name, time);
+        else
+            printf("%-10s %10s\n", backend.name, "n/a");
+    }
+
+    printf("\nSequential reads of the whole file\n%-10s %10s %10s\n", "backend", "ms", "MB/s");
+    for (const auto& backend : backends) {
+        int64_t bytes = 0;
+        double time = MeasureMilliseconds(repeats, [&]() {
+            bytes = Access::ReadFile(filename, backend.type, backend.readahead_size, 8, chunk_size);
+        });
+
+        if (bytes < 0)
+            printf("%-10s %10s\n", backend.name, "n/a");
+        else
+            printf("%-10s %10.2f %10.2f\n", backend.name, time, bytes / (time * 1e3));
+    }
+
+    // Every backend seeks to the same offsets
+    printf("\n%d random seeks, each followed by a %zu KiB read\n%-10s %10s %10s\n", seek_count, seek_read_size / 1024, "backend", "ms/seek", "MB/s");
+    for (const auto& backend : backends) {
+        int64_t bytes = 0;
+        double time = MeasureMilliseconds(repeats, [&]() {
+            bytes = Access::ReadRandom(filename, backend.type, backend.readahead_size, 8, seek_count, seek_read_size, chunk_size, 1234);
+        });
+
+        if (bytes < 0)
+            printf("%-10s %10s\n", backend.name, "n/a");
+        else
+            printf("%-10s %10.3f %10.2f\n", backend.name, time / seek_count, bytes / (time * 1e3));
+    }
+}
+
+// Many players reading at once, each with its own backend, like a wall of videos. io_uring keeps several reads
+// in flight per instance, while buffered reads block the thread until each chunk arrives.
+static void BenchmarkInstances(int argc, char** argv) {
+    if (argc < 1) {
+        printf("Arguments: <file> [max instances]\n");
+        return;
+    }
+
+    const olc::Media::FileName filename(argv[0]);
+    int max_instances = argc >= 2 ? std::max(atoi(argv[1]), 1) : 16;
+    const size_t chunk_size = 4096;
+
+    const struct { const char* name; olc::Media::FileIOType type; } backends[] = {
+        { "buffered", olc::Media::FileIOType::Buffered },
+        { "mmap", olc::Media::FileIOType::MemoryMapped },
+        { "io_uring", olc::Media::FileIOType::IoUring },
+    };
+
+    printf("%-10s %10s %10s %12s\n", "backend", "instances", "ms", "total MB/s");
+    for (const auto& backend : backends) {
+        for (int instances = 1; instances <= max_instances; instances *= 2) {
+            std::vector<int64_t> bytes(instances);
+            double time = MeasureMilliseconds(1, [&]() {
+                std::vector<std::thread> threads;
+                for (int i = 0; i < instances; i++) {
+                    threads.emplace_back([&, i]() {
+                        bytes[i] = Access::ReadFile(filename, backend.type, 0, 8, chunk_size);
+                    });
+                }
+
+                for (std::thread& thread : threads)
+                    thread.join();
+            });
+
+            int64_t total = 0;
+            for (int64_t instance_bytes : bytes)
+                total = (total < 0 || instance_bytes < 0) ? -1 : total + instance_bytes;
+
+            if (total < 0)
+                printf("%-10s %10d %10s\n", backend.name, instances, "n/a");
+            else
+                printf("%-10s %10d %10.2f %12.2f\n", backend.name, instances, time, total / (time * 1e3));
+        }
+    }
+}
+
+struct Benchmark {
+    const char* name;
+    const char* description;
+    void (*run)(int argc, char** argv);
+};
+
+static const Benchmark benchmarks[] = {
+    { "convert", "swscale conversion straight into frame pixels vs. through a temporary frame (1080p and 4K)", BenchmarkConvert },
+    { "bands", "speedup of converting frames in parallel bands with 1, 2, 4 and 8 threads (1080p and 4K)", BenchmarkBands },
+    { "io", "opening, reading and seeking a file through the buffered, readahead, memory mapped and io_uring backends", BenchmarkIO },
+    { "instances", "aggregate read throughput of 1 to N concurrent instances with buffered, memory mapped and io_uring backends", BenchmarkInstances },
+};
+
+int main(int argc, char** argv) {
+    if (argc >= 2) {
+        for (const Benchmark& benchmark : benchmarks) {
+            if (strcmp(argv[1], benchmark.name) == 0) {
+                benchmark.run(argc - 2, argv + 2);
+                return 0;
+            }
+        }
+    }
+
+    printf("Usage: %s <benchmark> [arguments]\n\nBenchmarks:\n", argv[0]);
+    for (const Benchmark& benchmark : benchmarks)
+        printf("  %-10s %s\n", benchmark.name, benchmark.description);
+
+    return argc >= 2 ? 1 : 0;
+}
@@ -0,0 +1,552 @@
+// Checks that every YuvConverter and RgbConverter kernel the CPU supports gives exactly the same pixels as the scalar
+// one, that the converters pick the frames and rows they should, that the results match swscale, and times the
+// kernels against swscale.
+//
+// Build from the repository root (olcPixelGameEngine.h and miniaudio.h have to be next to olcPGEX_Media.h):
+//   g++ -std=c++17 -O2 -I. tests/yuv_convert.cpp -o yuv_convert -lavformat -lavcodec -lswscale -lswresample -lavutil -lX11 -lGL -lpng -lpthread -lstdc++fs
+// Returns non-zero if any of the checks fail.
+
+#define OLC_PGE_APPLICATION
+#include "olcPixelGameEngine.h"
+
+#include "olcPGEX_Media.h"
+
+#include <random>
+
+namespace olc {
+    struct MediaTestAccess {
+        typedef Media::YuvConverter Yuv;
+        typedef Media::RgbConverter Rgb;
+
+        struct YuvKernel {
+            const char* name;
+            Yuv::RowFunction planar;
+            Yuv::RowFunction interleaved;
+        };
+
+        struct RgbKernel {
+            const char* name;
+            Rgb::RowFunction convert_row;
+        };
+
+        // Scalar kernel is always first
+        static std::vector<YuvKernel> GetYuvKernels() {
+            std::vector<YuvKernel> kernels = { { "Scalar", Yuv::ConvertRowScalar<false>, Yuv::ConvertRowScalar<true> } };
+#ifdef OLC_MEDIA_X86
+            if (Media::CpuFeatures::Get().sse41)
+                kernels.push_back({ "SSE4.1", Yuv::ConvertRowSSE41<false>, Yuv::ConvertRowSSE41<true> });
+            if (Media::CpuFeatures::Get().avx2)
+                kernels.push_back({ "AVX2", Yuv::ConvertRowAVX2<false>, Yuv::ConvertRowAVX2<true> });
+#endif // OLC_MEDIA_X86
+#ifdef OLC_MEDIA_NEON
+            kernels.push_back({ "NEON", Yuv::ConvertRowNEON<false>, Yuv::ConvertRowNEON<true> });
+#endif // OLC_MEDIA_NEON
+            return kernels;
+        }
+
+        static std::vector<RgbKernel> GetRgbKernels() {
+            std::vector<RgbKernel> kernels = { { "Scalar", Rgb::ConvertRowScalar } };
+#ifdef OLC_MEDIA_X86
+            if (Media::CpuFeatures::Get().sse41)
+                kernels.push_back({ "SSSE3", Rgb::ConvertRowSSSE3 });
+#endif // OLC_MEDIA_X86
+#ifdef OLC_MEDIA_NEON
+            kernels.push_back({ "NEON", Rgb::ConvertRowNEON });
+#endif // OLC_MEDIA_NEON
+            return kernels;
+        }
+
+        // Same as "YuvConverter::ConvertRows()", but with the given kernel. Only used to compare kernels with each other.
+        static void ConvertYuvFrame(const YuvKernel& kernel, const AVFrame* frame, olc::Pixel* target) {
+            bool interleaved = frame->format == AV_PIX_FMT_NV12;
+            Yuv::RowFunction convert_row = interleaved ? kernel.interleaved : kernel.planar;
+            Yuv::Coefficients c = Yuv::GetCoefficients(frame);
+
+            for (int row = 0; row < frame->height; row++) {
+                const uint8_t* y = frame->data[0] + ptrdiff_t(row) * frame->linesize[0];
+                const uint8_t* u = frame->data[1] + ptrdiff_t(row / 2) * frame->linesize[1];
+                const uint8_t* v = interleaved ? nullptr : frame->data[2] + ptrdiff_t(row / 2) * frame->linesize[2];
+                convert_row(y, u, v, target + ptrdiff_t(row) * frame->width, frame->width, c);
+            }
+        }
+
+        // Same as "RgbConverter::ConvertRows()", but with the given kernel. Only used to compare kernels with each other.
+        static void ConvertRgbFrame(const RgbKernel& kernel, const AVFrame* frame, olc::Pixel* target) {
+            Rgb::Layout layout = Rgb::GetLayout((AVPixelFormat)frame->format);
+            for (int row = 0; row < frame->height; row++)
+                kernel.convert_row(frame->data[0] + ptrdiff_t(row) * frame->linesize[0], target + ptrdiff_t(row) * frame->width, frame->width, layout);
+        }
+    };
+}
+
+typedef olc::MediaTestAccess Access;
+
+// Converter uses coefficients with 6 fractional bits and doesn't interpolate chroma, so it's allowed to be a bit off
+// from swscale and from the exact formula
+static const int max_swscale_difference = 4;
+static const int max_reference_difference = 3;
+
+static std::mt19937 rng(1234);
+
+struct YuvCase {
+    AVPixelFormat format;
+    AVColorSpace colorspace;
+    AVColorRange range;
+};
+
+static const char* GetColorName(const YuvCase& yuv_case) {
+    bool bt709 = yuv_case.colorspace == AVCOL_SPC_BT709;
+    bool full = yuv_case.range == AVCOL_RANGE_JPEG || yuv_case.format == AV_PIX_FMT_YUVJ420P;
+    if (bt709)
+        return full ? "BT.709 full" : "BT.709 limited";
+    return full ? "BT.601 full" : "BT.601 limited";
+}
+
+// Luma is random. Chroma is either random, or smooth, so that the result doesn't depend on how chroma is upsampled.
+static AVFrame* CreateYuvFrame(const YuvCase& yuv_case, int width, int height, bool smooth_chroma) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = yuv_case.format;
+    frame->width = width;
+    frame->height = height;
+    frame->colorspace = yuv_case.colorspace;
+    frame->color_range = yuv_case.range;
+    if (av_frame_get_buffer(frame, 64) < 0) {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (int row = 0; row < height; row++) {
+        for (int x = 0; x < width; x++)
+            frame->data[0][row * frame->linesize[0] + x] = uint8_t(byte(rng));
+    }
+
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    auto chroma = [&](int x, int row, int plane) {
+        if (smooth_chroma == false)
+            return uint8_t(byte(rng));
+
+        double phase = plane == 0 ? 0.0 : 1.7;
+        return uint8_t(128.0 + 100.0 * std::sin(x * 0.005 + row * 0.004 + phase));
+    };
+
+    for (int row = 0; row < chroma_height; row++) {
+        for (int x = 0; x < chroma_width; x++) {
+            if (yuv_case.format == AV_PIX_FMT_NV12) {
+                frame->data[1][row * frame->linesize[1] + x * 2] = chroma(x, row, 0);
+                frame->data[1][row * frame->linesize[1] + x * 2 + 1] = chroma(x, row, 1);
+            }
+            else {
+                frame->data[1][row * frame->linesize[1] + x] = chroma(x, row, 0);
+                frame->data[2][row * frame->linesize[2] + x] = chroma(x, row, 1);
+            }
+        }
+    }
+
+    return frame;
+}
+
+static AVFrame* CreateRgbFrame(AVPixelFormat format, int width, int height) {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    if (av_frame_get_buffer(frame, 64) < 0) {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (int row = 0; row < height; row++) {
+        for (int x = 0; x < frame->linesize[0]; x++)
+            frame->data[0][row * frame->linesize[0] + x] = uint8_t(byte(rng));
+    }
+
+    return frame;
+}
+
+// Converts the frame to RGB0 with swscale, the same way the player does when the SIMD converters can't be used
+static bool ConvertWithSwscale(const AVFrame* frame, olc::Pixel* target, int flags, int iterations = 1) {
+    SwsContext* ctx = sws_getContext(frame->width, frame->height, (AVPixelFormat)frame->format,
+        frame->width, frame->height, AV_PIX_FMT_RGB0, flags, NULL, NULL, NULL);
+    if (ctx == nullptr)
+        return false;
+
+    // yuvj420p is always full range, and packed RGB doesn't have a color space
+    if (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_NV12) {
+        bool full_range = frame->color_range == AVCOL_RANGE_JPEG;
+        int colorspace = frame->colorspace == AVCOL_SPC_BT709 ? SWS_CS_ITU709 : SWS_CS_ITU601;
+        sws_setColorspaceDetails(ctx, sws_getCoefficients(colorspace), full_range, sws_getCoefficients(SWS_CS_DEFAULT), 1, 0, 1 << 16, 1 << 16);
+    }
+
+    uint8_t* dest[4] = { reinterpret_cast<uint8_t*>(target), nullptr, nullptr, nullptr };
+    int dest_linesize[4] = { frame->width * int(sizeof(olc::Pixel)), 0, 0, 0 };
+    for (int i = 0; i < iterations; i++)
+        sws_scale(ctx, frame->data, frame->linesize, 0, frame->height, dest, dest_linesize);
+
+    sws_freeContext(ctx);
+    return true;
+}
+
+// Converts the frame with the exact BT.601/BT.709 formulas, in floating point. Every chroma sample covers 2x2 pixels.
+static void ConvertWithFormula(const AVFrame* frame, olc::Pixel* target) {
+    bool interleaved = frame->format == AV_PIX_FMT_NV12;
+    bool full_range = frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P;
+    double kr = frame->colorspace == AVCOL_SPC_BT709 ? 0.2126 : 0.299;
+    double kb = frame->colorspace == AVCOL_SPC_BT709 ? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+
+    auto clamp = [](double value) { return uint8_t(std::min(std::max(std::lround(value), 0L), 255L)); };
+
+    for (int row = 0; row < frame->height; row++) {
+        for (int x = 0; x < frame->width; x++) {
+            const uint8_t* chroma = frame->data[1] + (row / 2) * frame->linesize[1];
+            double y = frame->data[0][row * frame->linesize[0] + x];
+            double u = interleaved ? chroma[(x / 2) * 2] : chroma[x / 2];
+            double v = interleaved ? chroma[(x / 2) * 2 + 1] : frame->data[2][(row / 2) * frame->linesize[2] + x / 2];
+
+            if (full_range) {
+                u -= 128.0;
+                v -= 128.0;
+            }
+            else {
+                y = (y - 16.0) * 255.0 / 219.0;
+                u = (u - 128.0) * 255.0 / 224.0;
+                v = (v - 128.0) * 255.0 / 224.0;
+            }
+
+            target[row * frame->width + x] = olc::Pixel(
+                clamp(y + 2.0 * (1.0 - kr) * v),
+                clamp(y - 2.0 * kb * (1.0 - kb) / kg * u - 2.0 * kr * (1.0 - kr) / kg * v),
+                clamp(y + 2.0 * (1.0 - kb) * u));
+        }
+    }
+}
+
+// Returns the biggest difference of a color channel. Alpha isn't compared, as swscale leaves it at 0 for RGB0.
+static int CompareColors(const std::vector<olc::Pixel>& a, const std::vector<olc::Pixel>& b) {
+    int difference = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        difference = std::max(difference, std::abs(int(a[i].r) - int(b[i].r)));
+        difference = std::max(difference, std::abs(int(a[i].g) - int(b[i].g)));
+        difference = std::max(difference, std::abs(int(a[i].b) - int(b[i].b)));
+    }
+    return difference;
+}
+
+static int CheckYuvKernels(const std::vector<YuvCase>& cases) {
+    std::vector<Access::YuvKernel> kernels = Access::GetYuvKernels();
+    int failures = 0;
+
+    // Odd widths and heights leave pixels for the scalar tail of SIMD kernels, and a half used chroma sample
+    const int widths[] = { 1, 2, 3, 7, 15, 16, 17, 31, 33, 63, 65, 101, 255 };
+    const int heights[] = { 1, 2, 5 };
+
+    for (const YuvCase& yuv_case : cases) {
+        for (int width : widths) {
+            for (int height : heights) {
+                AVFrame* frame = CreateYuvFrame(yuv_case, width, height, false);
+                if (frame == nullptr) {
+                    printf("FAIL: couldn't allocate %dx%d frame\n", width, height);
+                    failures++;
+                    continue;
+                }
+
+                std::vector<olc::Pixel> expected(size_t(width) * height);
+                Access::ConvertYuvFrame(kernels[0], frame, expected.data());
+
+                std::vector<olc::Pixel> reference(expected.size());
+                ConvertWithFormula(frame, reference.data());
+                int difference = CompareColors(expected, reference);
+                if (difference > max_reference_difference) {
+                    printf("FAIL: %s %s %dx%d differs from the formula by %d\n", yuv_case.format == AV_PIX_FMT_NV12 ? "nv12" : "yuv420p",
+                        GetColorName(yuv_case), width, height, difference);
+                    failures++;
+                }
+
+                for (size_t k = 1; k < kernels.size(); k++) {
+                    std::vector<olc::Pixel> result(expected.size());
+                    Access::ConvertYuvFrame(kernels[k], frame, result.data());
+
+                    for (size_t i = 0; i < result.size(); i++) {
+                        if (result[i].n != expected[i].n) {
+                            printf("FAIL: %s %s %s %dx%d differs from scalar at pixel %zu\n", kernels[k].name,
+                                yuv_case.format == AV_PIX_FMT_NV12 ? "nv12" : "yuv420p", GetColorName(yuv_case), width, height, i);
+                            failures++;
+                            break;
+                        }
+                    }
+                }
+
+                av_frame_free(&frame);
+            }
+        }
+    }
+
+    return failures;
+}
+
+// Converts the frame the way the player does: in two bands split at an odd row, like threads split it
+template<typename Converter>
+static void ConvertInBands(const AVFrame* frame, olc::Pixel* target) {
+    int split = (frame->height / 2) | 1;
+    Converter::ConvertRows(frame, target, 0, std::min(split, frame->height));
+    Converter::ConvertRows(frame, target, std::min(split, frame->height), frame->height);
+}
+
+// Checks "CanConvert()" and "ConvertRows()" of both converters, which pick the kernel themselves
+static int CheckConverters(const std::vector<YuvCase>& cases) {
+    std::vector<Access::YuvKernel> yuv_kernels = Access::GetYuvKernels();
+    std::vector<Access::RgbKernel> rgb_kernels = Access::GetRgbKernels();
+    int failures = 0;
+
+    auto check = [&](bool condition, const char* description, const char* format) {
+        if (condition == false) {
+            printf("FAIL: %s (%s)\n", description, format);
+            failures++;
+        }
+    };
+
+    for (const YuvCase& yuv_case : cases) {
+        AVFrame* frame = CreateYuvFrame(yuv_case, 65, 7, false);
+        if (frame == nullptr) {
+            printf("FAIL: couldn't allocate frame\n");
+            failures++;
+            continue;
+        }
+
+        const char* name = av_get_pix_fmt_name(yuv_case.format);
+        check(Access::Yuv::CanConvert(frame, frame->width, frame->height), "YuvConverter can't convert a frame of the output size", name);
+        check(Access::Yuv::CanConvert(frame, frame->width * 2, frame->height) == false, "YuvConverter would scale a frame", name);
+        check(Access::Rgb::CanConvert(frame, frame->width, frame->height) == false, "RgbConverter would convert a YUV frame", name);
+
+        std::vector<olc::Pixel> expected(size_t(frame->width) * frame->height);
+        Access::ConvertYuvFrame(yuv_kernels[0], frame, expected.data());
+
+        std::vector<olc::Pixel> result(expected.size());
+        ConvertInBands<Access::Yuv>(frame, result.data());
+        check(memcmp(result.data(), expected.data(), result.size() * sizeof(olc::Pixel)) == 0, "YuvConverter differs from scalar", name);
+
+        av_frame_free(&frame);
+    }
+
+    // Other YUV formats are left to swscale. Only the format of these frames matters.
+    for (AVPixelFormat format : { AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV444P, AV_PIX_FMT_NV21 }) {
+        AVFrame* frame = CreateRgbFrame(format, 64, 4);
+        if (frame == nullptr)
+            continue;
+
+        check(Access::Yuv::CanConvert(frame, frame->width, frame->height) == false, "YuvConverter would convert an unsupported format", av_get_pix_fmt_name(format));
+        av_frame_free(&frame);
+    }
+
+    const AVPixelFormat rgb_formats[] = {
+        AV_PIX_FMT_RGBA, AV_PIX_FMT_BGRA, AV_PIX_FMT_ARGB, AV_PIX_FMT_ABGR, AV_PIX_FMT_RGB0,
+        AV_PIX_FMT_BGR0, AV_PIX_FMT_0RGB, AV_PIX_FMT_0BGR, AV_PIX_FMT_RGB24, AV_PIX_FMT_BGR24,
+    };
+
+    for (AVPixelFormat format : rgb_formats) {
+        AVFrame* frame = CreateRgbFrame(format, 65, 7);
+        if (frame == nullptr) {
+            printf("FAIL: couldn't allocate frame\n");
+            failures++;
+            continue;
+        }
+
+        const char* name = av_get_pix_fmt_name(format);
+        check(Access::Rgb::CanConvert(frame, frame->width, frame->height), "RgbConverter can't convert a frame of the output size", name);
+        check(Access::Rgb::CanConvert(frame, frame->width, frame->height * 2) == false, "RgbConverter would scale a frame", name);
+        check(Access::Yuv::CanConvert(frame, frame->width, frame->height) == false, "YuvConverter would convert an RGB frame", name);
+
+        std::vector<olc::Pixel> expected(size_t(frame->width) * frame->height);
+        Access::ConvertRgbFrame(rgb_kernels[0], frame, expected.data());
+
+        std::vector<olc::Pixel> result(expected.size());
+        ConvertInBands<Access::Rgb>(frame, result.data());
+        check(memcmp(result.data(), expected.data(), result.size() * sizeof(olc::Pixel)) == 0, "RgbConverter differs from scalar", name);
+
+        av_frame_free(&frame);
+    }
+
+    return failures;
+}
+
+static int CheckYuvAgainstSwscale(const std::vector<YuvCase>& cases) {
+    std::vector<Access::YuvKernel> kernels = Access::GetYuvKernels();
+    int failures = 0;
+
+    for (const YuvCase& yuv_case : cases) {
+        AVFrame* frame = CreateYuvFrame(yuv_case, 319, 181, true);
+        if (frame == nullptr) {
+            printf("FAIL: couldn't allocate frame\n");
+            failures++;
+            continue;
+        }
+
+        std::vector<olc::Pixel> reference(size_t(frame->width) * frame->height);
+        if (ConvertWithSwscale(frame, reference.data(), SWS_BILINEAR | SWS_ACCURATE_RND | SWS_FULL_CHR_H_INT) == false) {
+            printf("FAIL: couldn't create SwsContext\n");
+            failures++;
+            av_frame_free(&frame);
+            continue;
+        }
+
+        std::vector<olc::Pixel> result(reference.size());
+        Access::ConvertYuvFrame(kernels.back(), frame, result.data());
+
+        int difference = CompareColors(result, reference);
+        printf("%-8s %-15s difference from swscale: %d\n", yuv_case.format == AV_PIX_FMT_NV12 ? "nv12" : "yuv420p", GetColorName(yuv_case), difference);
+        if (difference > max_swscale_difference) {
+            printf("FAIL: difference is bigger than %d\n", max_swscale_difference);
+            failures++;
+        }
+
+        av_frame_free(&frame);
+    }
+
+    return failures;
+}
+
+static int CheckRgbKernels() {
+    std::vector<Access::RgbKernel> kernels = Access::GetRgbKernels();
+    int failures = 0;
+
+    const AVPixelFormat formats[] = {
+        AV_PIX_FMT_RGBA, AV_PIX_FMT_BGRA, AV_PIX_FMT_ARGB, AV_PIX_FMT_ABGR, AV_PIX_FMT_RGB0,
+        AV_PIX_FMT_BGR0, AV_PIX_FMT_0RGB, AV_PIX_FMT_0BGR, AV_PIX_FMT_RGB24, AV_PIX_FMT_BGR24,
+    };
+    const int widths[] = { 1, 3, 4, 5, 7, 15, 16, 17, 33, 101 };
+
+    for (AVPixelFormat format : formats) {
+        for (int width : widths) {
+            AVFrame* frame = CreateRgbFrame(format, width, 3);
+            if (frame == nullptr) {
+                printf("FAIL: couldn't allocate frame\n");
+                failures++;
+                continue;
+            }
+
+            std::vector<olc::Pixel> expected(size_t(width) * frame->height);
+            Access::ConvertRgbFrame(kernels[0], frame, expected.data());
+
+            for (size_t k = 1; k < kernels.size(); k++) {
+                std::vector<olc::Pixel> result(expected.size());
+                Access::ConvertRgbFrame(kernels[k], frame, result.data());
+
+                if (memcmp(result.data(), expected.data(), result.size() * sizeof(olc::Pixel)) != 0) {
+                    printf("FAIL: %s %s width %d differs from scalar\n", kernels[k].name, av_get_pix_fmt_name(format), width);
+                    failures++;
+                }
+            }
+
+            // Only channels are reordered, so swscale has to give exactly the same colors
+            std::vector<olc::Pixel> reference(expected.size());
+            if (ConvertWithSwscale(frame, reference.data(), SWS_POINT) == false || CompareColors(expected, reference) != 0) {
+                printf("FAIL: %s width %d differs from swscale\n", av_get_pix_fmt_name(format), width);
+                failures++;
+            }
+
+            av_frame_free(&frame);
+        }
+    }
+
+    return failures;
+}
+
+template<typename Function>
+static double MeasureMilliseconds(int iterations, Function function) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        function();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+static void BenchmarkKernels() {
+    const int width = 1920;
+    const int height = 1080;
+    const int iterations = 50;
+
+    printf("\n1920x1080, milliseconds per frame:\n");
+
+    const AVPixelFormat yuv_formats[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12 };
+    for (AVPixelFormat format : yuv_formats) {
+        AVFrame* frame = CreateYuvFrame({ format, AVCOL_SPC_BT709, AVCOL_RANGE_MPEG }, width, height, false);
+        if (frame == nullptr)
+            continue;
+
+        std::vector<olc::Pixel> target(size_t(width) * height);
+        const char* name = format == AV_PIX_FMT_NV12 ? "nv12" : "yuv420p";
+
+        // Same flags the player uses by default
+        bool converted = false;
+        double swscale_time = MeasureMilliseconds(1, [&]() {
+            converted = ConvertWithSwscale(frame, target.data(), SWS_BILINEAR, iterations);
+        }) / iterations;
+        if (converted)
+            printf("%-8s %-8s %7.3f\n", name, "swscale", swscale_time);
+
+        for (const Access::YuvKernel& kernel : Access::GetYuvKernels()) {
+            printf("%-8s %-8s %7.3f\n", name, kernel.name, MeasureMilliseconds(iterations, [&]() {
+                Access::ConvertYuvFrame(kernel, frame, target.data());
+            }));
+        }
+
+        av_frame_free(&frame);
+    }
+
+    const AVPixelFormat rgb_formats[] = { AV_PIX_FMT_BGRA, AV_PIX_FMT_RGB24 };
+    for (AVPixelFormat format : rgb_formats) {
+        AVFrame* frame = CreateRgbFrame(format, width, height);
+        if (frame == nullptr)
+            continue;
+
+        std::vector<olc::Pixel> target(size_t(width) * height);
+        const char* name = av_get_pix_fmt_name(format);
+
+        bool converted = false;
+        double swscale_time = MeasureMilliseconds(1, [&]() {
+            converted = ConvertWithSwscale(frame, target.data(), SWS_BILINEAR, iterations);
+        }) / iterations;
+        if (converted)
+            printf("%-8s %-8s %7.3f\n", name, "swscale", swscale_time);
+
+        for (const Access::RgbKernel& kernel : Access::GetRgbKernels()) {
+            printf("%-8s %-8s %7.3f\n", name, kernel.name, MeasureMilliseconds(iterations, [&]() {
+                Access::ConvertRgbFrame(kernel, frame, target.data());
+            }));
+        }
+
+        av_frame_free(&frame);
+    }
+}
+
+int main() {
+    std::vector<YuvCase> cases;
+    for (AVPixelFormat format : { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12 }) {
+        for (AVColorSpace colorspace : { AVCOL_SPC_BT470BG, AVCOL_SPC_BT709 }) {
+            for (AVColorRange range : { AVCOL_RANGE_MPEG, AVCOL_RANGE_JPEG })
+                cases.push_back({ format, colorspace, range });
+        }
+    }
+    cases.push_back({ AV_PIX_FMT_YUVJ420P, AVCOL_SPC_BT470BG, AVCOL_RANGE_UNSPECIFIED });
+
+    printf("YUV kernels:");
+    for (const Access::YuvKernel& kernel : Access::GetYuvKernels())
+        printf(" %s", kernel.name);
+    printf("\nRGB kernels:");
+    for (const Access::RgbKernel& kernel : Access::GetRgbKernels())
+        printf(" %s", kernel.name);
+    printf("\n\n");
+
+    int failures = CheckYuvKernels(cases);
+    failures += CheckConverters(cases);
+    failures += CheckYuvAgainstSwscale(cases);
+    failures += CheckRgbKernels();
+
+    BenchmarkKernels();
+
+    printf("\n%s (%d failures)\n", failures == 0 ? "PASSED" : "FAILED", failures);
+    return failures == 0 ? 0 : 1;
+}